@@ -0,0 +1,133 @@
+import cv2
+import numpy as np
+import argparse
+import sys
+import random
+import time
+from os import listdir
+from os.path import isfile, isdir, join
+
+from main import load_dnn_model, make_blob, face_extractor_dnn_batch, box_iou, CALIB_FILE
+
+# 얼굴 검출기(SSD) INT8 양자화용 보정 데이터 생성 및 fp16/int8 성능 비교
+# 양자화(Net.quantize)는 OpenCV 4.5.5 ~ 4.x에서만 가능, 없으면 bench는 비교하지 않고 실패로 끝남
+CALIB_SIZE = 48        # 보정에 사용할 이미지 수
+EVAL_SIZE = 48         # 비교 평가에 사용할 이미지 수
+FRAME_SIZE = (640, 480)
+BENCH_ROUNDS = 3       # 지연시간 측정 반복 횟수
+
+
+def compose_frame(face_gray, rng):
+    # face/ 의 얼굴 사진(200x200 흑백)을 웹캠 프레임 크기의 배경 위에 임의 크기/위치로 배치
+    w, h = FRAME_SIZE
+    base = rng.randint(60, 180)
+    frame = np.full((h, w, 3), base, dtype=np.uint8)
+    noise = np.random.randint(-20, 20, (h, w, 1)).astype(np.int16)
+    frame = np.clip(frame.astype(np.int16) + noise, 0, 255).astype(np.uint8)
+
+    size = rng.randint(120, 320)
+    face = cv2.cvtColor(cv2.resize(face_gray, (size, size)), cv2.COLOR_GRAY2BGR)
+    x = rng.randint(0, w - size)
+    y = rng.randint(0, h - size)
+    frame[y:y + size, x:x + size] = face
+    return frame
+
+
+def load_samples(face_dir, frame_dir, count, seed):
+    # 보정/평가용 이미지 수집 : 캡처된 전체 프레임(frame_dir)을 우선 사용하고 부족하면 face/ 사진으로 합성
+    rng = random.Random(seed)
+    samples = []
+
+    if frame_dir and isdir(frame_dir):
+        files = [join(frame_dir, f) for f in listdir(frame_dir) if f.endswith('.jpg')]
+        rng.shuffle(files)
+        for path in files:
+            img = cv2.imread(path)
+            if img is not None:
+                samples.append(img)
+            if len(samples) >= count:
+                return samples
+
+    faces = []
+    for user in listdir(face_dir):
+        user_dir = join(face_dir, user)
+        if isdir(user_dir):
+            faces += [join(user_dir, f) for f in listdir(user_dir) if isfile(join(user_dir, f))]
+    rng.shuffle(faces)
+    for path in faces:
+        img = cv2.imread(path, cv2.IMREAD_GRAYSCALE)
+        if img is not None:
+            samples.append(compose_frame(img, rng))
+        if len(samples) >= count:
+            break
+    return samples
+
+
+def calibrate(face_dir, frame_dir):
+    samples = load_samples(face_dir, frame_dir, CALIB_SIZE, seed=1)
+    if len(samples) == 0:
+        print("보정에 사용할 이미지가 없습니다. 먼저 Face_extractor.py로 얼굴을 캡처하세요.")
+        return
+    blob = make_blob(samples)
+    np.save(CALIB_FILE, blob)
+    print(f"보정 데이터 {len(samples)}장을 {CALIB_FILE}에 저장했습니다.")
+
+
+def measure(net, samples):
+    # 한 장씩 forward 지연시간(ms)과 검출 결과 측정
+    times, results = [], []
+    for _ in range(BENCH_ROUNDS):
+        results = []
+        for img in samples:
+            t0 = time.perf_counter()
+            box = face_extractor_dnn_batch([img], net)[0]
+            times.append((time.perf_counter() - t0) * 1000.0)
+            results.append(box)
+    times.sort()
+    return times, results
+
+
+def bench(face_dir, frame_dir):
+    samples = load_samples(face_dir, frame_dir, EVAL_SIZE, seed=2)
+    if len(samples) == 0:
+        print("평가에 사용할 이미지가 없습니다.")
+        return
+
+    fp16, _ = load_dnn_model("fp16")
+    int8, precision = load_dnn_model("int8")
+    if precision != "int8":
+        # fp16끼리 비교한 결과를 int8 결과처럼 출력하지 않도록 중단
+        sys.exit("INT8 검출기를 만들지 못해 비교할 수 없습니다(위 메시지 참고).")
+    face_extractor_dnn_batch(samples[:1], fp16)  # 첫 forward(초기화) 제외
+    face_extractor_dnn_batch(samples[:1], int8)
+
+    t16, r16 = measure(fp16, samples)
+    t8, r8 = measure(int8, samples)
+
+    # 정확도 : fp16 검출 결과를 기준으로 int8이 같은 얼굴(IoU >= 0.5)을 찾았는지 비교
+    ref = sum(1 for b in r16 if b is not None)
+    matched = sum(1 for a, b in zip(r16, r8) if a is not None and b is not None and box_iou(a, b) >= 0.5)
+    extra = sum(1 for a, b in zip(r16, r8) if a is None and b is not None)
+
+    def line(name, t):
+        return f"{name}: 평균 {sum(t) / len(t):.2f}ms, p50 {t[len(t) // 2]:.2f}ms, p95 {t[int(len(t) * 0.95)]:.2f}ms"
+
+    print(f"평가 이미지 {len(samples)}장")
+    print(line("fp16", t16))
+    print(line("int8", t8))
+    print(f"속도 향상 : {sum(t16) / sum(t8):.2f}배")
+    if ref > 0:
+        print(f"fp16 검출 {ref}개 중 int8 일치 {matched}개 ({100.0 * matched / ref:.1f}%), int8 추가 검출 {extra}개")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="얼굴 검출기 INT8 양자화 보정 및 성능 비교")
+    parser.add_argument("command", choices=["calibrate", "bench"])
+    parser.add_argument("--faces", default="face/", help="Face_extractor.py로 캡처한 얼굴 폴더")
+    parser.add_argument("--frames", default=None, help="전체 프레임 이미지 폴더(예: 외부인 캡처 폴더)")
+    args = parser.parse_args()
+
+    if args.command == "calibrate":
+        calibrate(args.faces, args.frames)
+    else:
+        bench(args.faces, args.frames)
@@ -1,47 +1,217 @@
 import cv2
 import numpy as np
-from os import listdir, makedirs
+from os import listdir
 from os.path import isfile, join, exists
-from datetime import datetime  
 import socket
+import struct
 import time
 import threading
-
-# 전역 플래그로 카메라 상태를 관리
-camera_active = True
-
-def load_dnn_model():
+import json
+import os
+import tempfile
+from collections import deque
+
+# 검출 주기 설정 : DNN 검출은 N프레임마다 또는 움직임이 있을 때만 실행
+DETECT_INTERVAL = 5        # 추적 중 DNN 재검출 주기(프레임)
+MOTION_THRESHOLD = 0.02    # 움직임으로 판단할 변화 픽셀 비율
+TRACK_MIN_SCORE = 0.5      # 추적 실패로 판단할 템플릿 매칭 점수
+RECOG_IOU = 0.6            # 마지막 인식 박스와의 IoU가 이보다 작으면 재인식
+RECOG_VOTE_INTERVAL = 0.1  # 판정 중(쿨다운 아님)에는 이 주기(초)마다 재인식, 표는 새로 인식한 결과만
+DISPLAY_SIZE = (512, 600)  # 화면 한쪽 영역 크기(w, h)
+
+# 파이프라인 설정 : 단계 사이 큐는 가득 차면 가장 오래된 항목을 버림
+FRAME_QUEUE_SIZE = 2       # 캡처 -> 검출
+TRACK_QUEUE_SIZE = 2       # 검출 -> 인식
+DISPLAY_QUEUE_SIZE = 1     # 인식 -> 화면
+SEND_QUEUE_SIZE = 32       # 인식 -> 소켓 전송
+STATS_INTERVAL = 10.0      # 단계별 처리 시간 출력 주기(초)
+
+# 서버 및 카메라 설정 : cameras.json이 있으면 방별 카메라 목록을 읽음
+HOST = '192.168.0.15'
+PORT = 9000
+CAMERA_CONFIG = "cameras.json"   # [{"room": "201", "source": 0, "display": true}, ...]
+DEFAULT_CAMERAS = [{"room": "201", "source": 0, "display": True}]
+MAX_BATCH = 8              # 한 번의 DNN forward에 묶을 최대 프레임 수
+IMAGE_CHUNK = 16384        # 이미지 전송 청크 크기(바이트)
+JPEG_QUALITY = 90
+THUMB_WIDTHS = (160, 320)  # 웹 로그 화면용 썸네일 너비(작은/중간), 서버에 원본과 함께 전송
+THUMB_QUALITY = 80
+
+# 사건 직전 영상 : 카메라를 멈추지 않고 메모리 링버퍼에 최근 몇 초를 보관했다가 실패/캡처 요청 시 짧은 영상과 얼굴 사진을 보냄
+CLIP_SECONDS = 4           # 링버퍼에 보관할 시간(초)
+CLIP_FPS = 10              # 링버퍼 저장 주기(초당 프레임)
+CLIP_WIDTH = 320           # 영상 프레임 너비(메모리 절약을 위해 축소 저장)
+FACE_RING_SECONDS = 4.0    # 가장 잘 나온 얼굴 사진을 고를 구간(초)
+
+# 판정 설정 : 최근 VOTE_WINDOW 표 안에서 결과가 확정되는 즉시 판정(기존 20표 중 15표 성공 / 6표 실패 기준과 동일)
+# 표 하나 = LBPH 인식 한 번(추적만 한 프레임은 표가 아님), 성공 판정까지 최소 VOTE_SUCCESS * RECOG_VOTE_INTERVAL초
+VOTE_WINDOW = 20           # 판정에 쓰는 최대 표 수
+VOTE_SUCCESS = 15          # 성공 판정에 필요한 성공 표 수
+VOTE_FAILURE = 6           # 실패 판정에 필요한 실패 표 수
+VOTE_MAX_AGE = 5.0         # 이보다 오래된 표는 버림(초)
+UNLOCK_CONFIDENCE = 85     # 성공 표로 인정하는 인식률
+SUCCESS_COOLDOWN = 30.0    # 성공 판정 후 다음 판정까지 대기(초), 그동안 캡처/인식은 계속
+FAILURE_COOLDOWN = 10.0    # 실패 판정 후 다음 판정까지 대기(초)
+
+# 얼굴인식 세션 : 서버가 session_start를 보낸 동안만 전속력으로 검출/인식, 평소에는 저속 캡처만(캡처 요청용 최근 프레임과 영상)
+IDLE_FPS = 2               # 세션이 없을 때 캡처 주기(초당 프레임)
+ALWAYS_ON = False          # True면 세션 없이 항상 인식(세션을 보내지 않는 이전 서버용)
+
+# 검출기 정밀도 : "int8"이면 Quantize.py로 만든 보정 데이터로 양자화, 보정 데이터가 없으면 fp16 사용
+# Net.quantize는 OpenCV 4.5.5 ~ 4.x에만 있음(5.x에는 없어 항상 fp16으로 동작)
+DETECTOR_PRECISION = "int8"
+CALIB_FILE = "calib_blobs.npy"
+
+def load_dnn_model(precision=DETECTOR_PRECISION):
+    # (검출기, 실제 정밀도) 반환 : int8을 만들지 못하면 "fp16"
     model_file = "res10_300x300_ssd_iter_140000_fp16.caffemodel"
     config_file = "deploy.prototxt.txt"
     net = cv2.dnn.readNetFromCaffe(config_file, model_file)
-    return net
+    # CPU 전용 호스트 : 양자화 모델은 OpenCV 백엔드에서만 동작
+    net.setPreferableBackend(cv2.dnn.DNN_BACKEND_OPENCV)
+    net.setPreferableTarget(cv2.dnn.DNN_TARGET_CPU)
+
+    if precision == "int8":
+        if not exists(CALIB_FILE):
+            print(f"보정 데이터({CALIB_FILE})가 없어 fp16 검출기를 사용합니다. Quantize.py calibrate를 먼저 실행하세요.")
+            return net, "fp16"
+        if not hasattr(net, "quantize"):
+            print(f"OpenCV {cv2.__version__}에는 Net.quantize가 없어 fp16 검출기를 사용합니다(4.5.5 ~ 4.x 필요).")
+            return net, "fp16"
+        try:
+            calib = np.load(CALIB_FILE)
+            qnet = net.quantize([calib], cv2.CV_32F, cv2.CV_32F)  # 네트워크 입력이 하나라 보정 blob도 하나
+            qnet.setPreferableBackend(cv2.dnn.DNN_BACKEND_OPENCV)
+            qnet.setPreferableTarget(cv2.dnn.DNN_TARGET_CPU)
+            print(f"INT8 검출기 사용 (보정 이미지 {calib.shape[0]}장)")
+            return qnet, "int8"
+        except (cv2.error, ValueError) as e:
+            print(f"INT8 양자화 실패, fp16 검출기를 사용합니다: {e}")
+    return net, "fp16"
 
 
-def face_extractor_dnn(img, net):
-    blob = cv2.dnn.blobFromImage(img, 1.0, (300, 300), (104.0, 177.0, 123.0))
+def make_blob(imgs):
+    # 검출기 입력 전처리(300x300, 평균값 빼기), 양자화 보정 데이터도 같은 전처리를 사용
+    return cv2.dnn.blobFromImages(imgs, 1.0, (300, 300), (104.0, 177.0, 123.0))
+
+
+def face_extractor_dnn_batch(imgs, net):
+    # 여러 카메라의 프레임을 한 번의 forward로 검출, 이미지별 첫 번째 얼굴 박스 반환
+    blob = make_blob(imgs)
     net.setInput(blob)
     detections = net.forward()
 
-    h, w = img.shape[:2]
-    faces = []
-    face_box = None  
-
+    boxes = [None] * len(imgs)
     for i in range(detections.shape[2]):
+        image_id = int(detections[0, 0, i, 0])
         confidence = detections[0, 0, i, 2]
 
-        if confidence > 0.7:
+        if confidence > 0.7 and 0 <= image_id < len(imgs) and boxes[image_id] is None:
+            h, w = imgs[image_id].shape[:2]
             box = detections[0, 0, i, 3:7] * np.array([w, h, w, h])
             (x, y, x1, y1) = box.astype("int")
-            face_box = (x, y, x1, y1)  
-            cropped_face = img[y:y1, x:x1]
-            faces.append(cropped_face)
+            boxes[image_id] = (x, y, x1, y1)
+    return boxes
+
 
-    if len(faces) > 0:
-        return faces[0], face_box  
+def face_extractor_dnn(img, net):
+    face_box = face_extractor_dnn_batch([img], net)[0]
+    if face_box is not None:
+        x, y, x1, y1 = face_box
+        return img[y:y1, x:x1], face_box
     else:
         return None, None  
 
 
+def box_iou(a, b):
+    # 두 박스(x, y, x1, y1)의 IoU 계산
+    ix = max(0, min(a[2], b[2]) - max(a[0], b[0]))
+    iy = max(0, min(a[3], b[3]) - max(a[1], b[1]))
+    inter = ix * iy
+    union = (a[2] - a[0]) * (a[3] - a[1]) + (b[2] - b[0]) * (b[3] - b[1]) - inter
+    return inter / union if union > 0 else 0.0
+
+
+class MotionDetector:
+    # 축소된 흑백 프레임 차분으로 움직임 여부 판단
+    def __init__(self, threshold=MOTION_THRESHOLD):
+        self.threshold = threshold
+        self.prev = None
+
+    def update(self, frame):
+        small = cv2.cvtColor(cv2.resize(frame, (160, 120)), cv2.COLOR_BGR2GRAY)
+        small = cv2.GaussianBlur(small, (5, 5), 0)
+        moved = False
+        if self.prev is not None:
+            diff = cv2.absdiff(small, self.prev)
+            changed = np.count_nonzero(diff > 25)
+            moved = changed > self.threshold * diff.size
+        self.prev = small
+        return moved
+
+
+class FaceTracker:
+    # DNN 검출 사이에 얼굴 박스를 템플릿 매칭으로 추적하는 가벼운 추적기
+    def __init__(self):
+        self.box = None
+        self.template = None
+        self.track_id = 0
+
+    def start(self, gray, box):
+        x, y, x1, y1 = box
+        if x1 - x < 8 or y1 - y < 8:
+            self.reset()
+            return
+        if self.box is None or box_iou(self.box, box) < 0.3:
+            self.track_id += 1  # 다른 얼굴이면 새 트랙
+        self.box = box
+        self.template = gray[y:y1, x:x1].copy()
+
+    def update(self, gray):
+        if self.box is None:
+            return None
+        x, y, x1, y1 = self.box
+        w, h = x1 - x, y1 - y
+        # 이전 위치 주변만 탐색
+        sx, sy = max(0, x - w // 2), max(0, y - h // 2)
+        ex, ey = min(gray.shape[1], x1 + w // 2), min(gray.shape[0], y1 + h // 2)
+        region = gray[sy:ey, sx:ex]
+        if region.shape[0] < h or region.shape[1] < w:
+            self.reset()
+            return None
+        result = cv2.matchTemplate(region, self.template, cv2.TM_CCOEFF_NORMED)
+        _, score, _, loc = cv2.minMaxLoc(result)
+        if score < TRACK_MIN_SCORE:
+            self.reset()
+            return None
+        self.box = (sx + loc[0], sy + loc[1], sx + loc[0] + w, sy + loc[1] + h)
+        return self.box
+
+    def reset(self):
+        self.box = None
+        self.template = None
+
+
+def clip_box(box, w, h):
+    x, y, x1, y1 = box
+    return (max(0, x), max(0, y), min(w, x1), min(h, y1))
+
+
+def recognize_face(face, models):
+    # LBPH 모델들로 가장 가까운 사용자 찾기
+    min_score = 999
+    min_score_name = ""
+    face_gray = cv2.cvtColor(face, cv2.COLOR_BGR2GRAY)
+    face_resized = cv2.resize(face_gray, (200, 200))
+
+    for name, model in models.items():
+        result = model.predict(face_resized)
+        if min_score > result[1]:
+            min_score = result[1]
+            min_score_name = name
+    return min_score, min_score_name
+
+
 def load_models():
     model_dir = "model/"
     models = {}
@@ -55,161 +225,581 @@ def load_models():
     return models
 
 
-def get_current_time_str():
-    return datetime.now().strftime("%Y%m%d_%H%M%S")
+class DropQueue:
+    # 크기 제한 큐 : deque의 append/popleft는 원자적이라 락 없이 사용, 가득 차면 오래된 항목을 버림
+    def __init__(self, maxlen):
+        self.items = deque(maxlen=maxlen)
+        self.ready = threading.Event()
+        self.dropped = 0
 
+    def put(self, item):
+        if len(self.items) == self.items.maxlen:
+            self.dropped += 1
+        self.items.append(item)
+        self.ready.set()
 
-def receive_socket_data(s, stranger_dir, cap):
-    global camera_active, frame  # 전역 플래그 및 frame 사용
+    def get_nowait(self):
+        try:
+            return self.items.popleft()
+        except IndexError:
+            return None
+
+    def get(self, timeout=0.1):
+        while True:
+            try:
+                return self.items.popleft()
+            except IndexError:
+                self.ready.clear()
+                if len(self.items) == 0 and not self.ready.wait(timeout):
+                    return None
+
+
+class StageStats:
+    # 단계별 처리 시간(ms) 누적
+    def __init__(self, names):
+        self.lock = threading.Lock()
+        self.names = names
+        self.reset()
+
+    def reset(self):
+        self.batches = 0
+        self.batched_frames = 0
+        self.count = {n: 0 for n in self.names}
+        self.total = {n: 0.0 for n in self.names}
+        self.max = {n: 0.0 for n in self.names}
+
+    def add(self, name, ms):
+        with self.lock:
+            self.count[name] += 1
+            self.total[name] += ms
+            if ms > self.max[name]:
+                self.max[name] = ms
+
+    def add_batch(self, n):
+        with self.lock:
+            self.batches += 1
+            self.batched_frames += n
+
+    def report(self, queues):
+        with self.lock:
+            parts = []
+            if self.batches:
+                parts.append(f"batch avg {self.batched_frames / self.batches:.1f}장")
+            for n in self.names:
+                c = self.count[n]
+                avg = self.total[n] / c if c else 0.0
+                parts.append(f"{n} {c}회 avg {avg:.1f}ms max {self.max[n]:.1f}ms")
+            self.reset()
+        drops = ", ".join(f"{name} {q.dropped}" for name, q in queues)
+        print("[stats] " + " | ".join(parts) + f" | drop: {drops}")
+
+
+def now_ms():
+    return time.perf_counter() * 1000.0
+
+
+class VoteDecider:
+    # 슬라이딩 윈도우 투표 : 남은 표와 상관없이 결과가 정해지면 바로 판정하고, 쿨다운은 시간으로만 관리(sleep 없음)
+    def __init__(self):
+        self.votes = deque()     # (시각 ms, 성공 여부)
+        self.track_id = -1
+        self.cooldown_until = 0.0
+
+    def reset(self):
+        self.votes.clear()
+
+    def in_cooldown(self, t):
+        return t < self.cooldown_until
+
+    def add(self, t, track_id, ok):
+        # 새 사람(트랙)이면 이전 표는 버림, 판정이 나면 "success"/"failure" 반환
+        if self.in_cooldown(t):
+            return None
+        if track_id != self.track_id:
+            self.track_id = track_id
+            self.reset()
+        while self.votes and t - self.votes[0][0] > VOTE_MAX_AGE * 1000.0:
+            self.votes.popleft()
+        self.votes.append((t, ok))
+        if len(self.votes) > VOTE_WINDOW:
+            self.votes.popleft()
+
+        suc = sum(1 for _, v in self.votes if v)
+        fai = len(self.votes) - suc
+        if suc >= VOTE_SUCCESS:
+            return "success"
+        if fai >= VOTE_FAILURE:
+            return "failure"
+        return None
+
+    def finish(self, t, result):
+        # 판정 결과 반환 : (표 수, 첫 표부터 판정까지 걸린 ms), 이후 쿨다운 시작
+        first = self.votes[0][0] if self.votes else t
+        count = len(self.votes)
+        self.reset()
+        self.cooldown_until = t + (SUCCESS_COOLDOWN if result == "success" else FAILURE_COOLDOWN) * 1000.0
+        return count, t - first
+
+
+class Camera:
+    # 방 하나에 연결된 카메라와 그 방의 서버 소켓, 단계별 상태
+    def __init__(self, room, source, display):
+        self.room = str(room)
+        self.source = source
+        self.display = display
+        self.cap = None
+        self.sock = None
+        self.frame = None       # 가장 최근 프레임
+        self.clip_ring = deque(maxlen=CLIP_SECONDS * CLIP_FPS)  # (시각 ms, 축소 프레임)
+        self.face_ring = deque(maxlen=CLIP_SECONDS * 30)        # (시각 ms, 얼굴 넓이, 프레임)
+        self.frame_q = DropQueue(FRAME_QUEUE_SIZE)
+        self.track_q = DropQueue(TRACK_QUEUE_SIZE)
+        self.display_q = DropQueue(DISPLAY_QUEUE_SIZE)
+        self.send_q = DropQueue(SEND_QUEUE_SIZE)
+        self.tracker = FaceTracker()
+        self.motion = MotionDetector()
+        self.frames_since_detect = DETECT_INTERVAL
+        self.window_name = f'Face Recognition - room {self.room}'
+        self.canvas = None
+        self.session_lock = threading.Lock()
+        self.session_id = 0           # 진행 중인 세션(0이면 쉬는 중)
+        self.session_until = 0.0      # 세션이 끝나는 시각(ms)
+        self.wake = threading.Event() # 세션이 열리면 쉬고 있는 캡처 스레드를 바로 깨움
+
+    def tag(self, body):
+        return f'FR:room_{self.room}:{body}'
+
+    def session_active(self, t):
+        return ALWAYS_ON or (self.session_id != 0 and t < self.session_until)
+
+    def start_session(self, session_id, seconds):
+        # 같은 ID면 연장, 새 세션이면 첫 프레임부터 DNN 검출
+        with self.session_lock:
+            if session_id != self.session_id:
+                self.frames_since_detect = DETECT_INTERVAL
+            self.session_id = session_id
+            self.session_until = now_ms() + seconds * 1000.0
+        self.wake.set()
+
+    def end_session(self, result, session_id=None):
+        # 세션 종료(판정, 시간 초과, 서버 중지), 서버가 끝낸 경우가 아니면 결과를 알림
+        with self.session_lock:
+            if self.session_id == 0 or (session_id is not None and session_id != self.session_id):
+                return
+            ended = self.session_id
+            self.session_id = 0
+        print(f"{self.room}호 얼굴인식 세션 {ended} 종료: {result}")
+        if result != 'stopped':
+            self.send_q.put((self.tag(f'session_end:{ended}:{result}').encode(), None, None))
+
+    def queues(self):
+        return [(f'{self.room}.{n}', q) for n, q in
+                (('frame', self.frame_q), ('track', self.track_q), ('display', self.display_q), ('send', self.send_q))]
+
+
+def load_cameras():
+    # cameras.json이 없으면 기존처럼 201호 기본 웹캠 하나만 사용
+    config = DEFAULT_CAMERAS
+    if exists(CAMERA_CONFIG):
+        with open(CAMERA_CONFIG) as f:
+            config = json.load(f)
+    cameras = []
+    for c in config:
+        source = c.get("source", 0)
+        if isinstance(source, str) and source.isdigit():
+            source = int(source)
+        cameras.append(Camera(c["room"], source, c.get("display", True)))
+    return cameras
+
+
+def connect_room(cam, host, port):
+    # 방 소켓 접속 후 인사말 전송, 서버 방 목록에 FR 소켓이 등록됨
+    cam.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    cam.sock.connect((host, port))
+    cam.sock.sendall(f'FR:room_{cam.room}'.encode())
+
+
+def handle_server_line(cam, line):
+    # 서버 명령 한 줄 : request_capture, session_start:<ID>:<초>, session_stop:<ID>
+    if line == cam.tag('request_capture'):
+        print(f"{cam.room}호 캡처 요청을 받았습니다.")
+        # 카메라는 멈추지 않음 : 사진과 영상은 전송 단계에서 링버퍼로 만듦
+        if cam.frame is not None:
+            cam.send_q.put((None, 'capture', cam.frame))
+        else:
+            print("오류: 유효한 프레임이 없습니다.")
+    elif line.startswith(cam.tag('session_start:')):
+        _, session_id, seconds = line.rsplit(':', 2)
+        print(f"{cam.room}호 얼굴인식 세션 {session_id} 시작 ({seconds}초)")
+        cam.start_session(int(session_id), int(seconds))
+    elif line.startswith(cam.tag('session_stop:')):
+        cam.end_session('stopped', int(line.rsplit(':', 1)[1]))
+
+
+def receive_socket_data(cam):
+    # 방별 소켓 수신 스레드, 서버 메시지는 한 줄씩 처리
+    s = cam.sock
+    buf = ''
     while True:
         try:
             data = s.recv(1024).decode()
-            if data == 'FR:room_201:request_capture':
-                print("캡처 요청을 받았습니다.")
-                
-                # 카메라 스트림 중지
-                camera_active = False
-                time.sleep(1)  # 안전하게 카메라가 중지되도록 대기
-                
-                current_time = get_current_time_str()
-                capture = f'capture_{current_time}.jpg'
-                capture_path = join(stranger_dir, capture)
-
-                if frame is not None:
-                    cv2.imwrite(capture_path, frame)
-                    print(f"캡처된 이미지가 저장되었습니다: {capture_path}")
-                    s.sendall(f'FR:room_201:capture:{capture}'.encode())
-                else:
-                    print("오류: 유효한 프레임이 없습니다.")
-
-                # 카메라 스트림 재개
-                camera_active = True
-        except socket.error as e:
+            if not data:
+                print(f"{cam.room}호 서버 연결이 끊어졌습니다.")
+                break
+            buf += data
+            if buf == cam.tag('request_capture'):
+                buf += '\n'  # 이전 서버는 캡처 요청을 줄바꿈 없이 보냄
+            *lines, buf = buf.split('\n')
+            for line in lines:
+                line = line.strip()
+                if line.startswith('REDIRECT:'):
+                    # 여러 서버 노드로 나뉜 경우 이 방을 담당하는 노드로 다시 접속
+                    _, host, port = line.split(':')
+                    print(f"{cam.room}호 담당 서버 {host}:{port} 로 이동합니다.")
+                    s.close()
+                    connect_room(cam, host, int(port))
+                    s = cam.sock
+                    buf = ''
+                    break
+                handle_server_line(cam, line)
+        except (socket.error, ValueError) as e:
             print(f"소켓 오류: {e}")
             break
 
 
-def run(models, stranger_dir):
-    global camera_active, frame
-
-    net = load_dnn_model() 
-    cap = cv2.VideoCapture(0)  
-
-    if not cap.isOpened():
-        print("웹캠을 열 수 없습니다.")
-        return
-
-    confidence_suc = 0
-    confidence_fai = 0
-    confidence_cnt = 0
-
-    window_name = 'Face Recognition'
-    cv2.namedWindow(window_name, cv2.WND_PROP_FULLSCREEN)
-    cv2.setWindowProperty(window_name, cv2.WND_PROP_FULLSCREEN, cv2.WINDOW_NORMAL)
-    cv2.resizeWindow(window_name, 1024, 600)
-
-    HOST = '192.168.0.15' 
-    PORT = 9000  
-
-    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
-        s.connect((HOST, PORT))
-        s.sendall(b'FR:room_201')  
-
-        # 소켓 스레드 시작
-        socket_thread = threading.Thread(target=receive_socket_data, args=(s, stranger_dir, cap))
-        socket_thread.daemon = True 
-        socket_thread.start()
-
-        while True:
-            if camera_active:
-                ret, frame = cap.read()
-                if not ret:
-                    print("웹캠에서 프레임을 읽을 수 없습니다.")
-                    break
-
-                original_frame = cv2.resize(frame, (512, 600))  
-                face, face_box = face_extractor_dnn(frame, net) 
-
-                try:
-                    min_score = 999
-                    min_score_name = ""
-                    confidence = 0
-
-                    if face is not None:
-                        face_gray = cv2.cvtColor(face, cv2.COLOR_BGR2GRAY)
-                        face_resized = cv2.resize(face_gray, (200, 200))
-
-                        for name, model in models.items():
-                            result = model.predict(face_resized)
-                            if min_score > result[1]:
-                                min_score = result[1]
-                                min_score_name = name
+def capture_stage(cam, frames_ready, stats, stop):
+    # 1단계 : 카메라별 캡처 스레드, 뒤 단계가 느려도 큐에서 오래된 프레임이 버려질 뿐 캡처는 멈추지 않음
+    # 세션이 없으면 IDLE_FPS로만 읽고 검출 단계로 넘기지 않음(최근 프레임과 영상 링버퍼만 갱신)
+    seq = 0
+    clip_interval = 1000.0 / CLIP_FPS
+    last_clip = 0.0
+    while not stop.is_set():
+        active = cam.session_active(now_ms())
+        if not active:
+            if cam.session_id != 0:
+                cam.end_session('timeout')
+            if cam.wake.wait(1.0 / IDLE_FPS):
+                cam.wake.clear()
+                active = cam.session_active(now_ms())
+        t0 = now_ms()
+        ret, img = cam.cap.read()
+        if not ret:
+            print(f"{cam.room}호 카메라에서 프레임을 읽을 수 없습니다.")
+            stop.set()
+            break
+        cam.frame = img
+        seq += 1
+        if t0 - last_clip >= clip_interval:
+            h, w = img.shape[:2]
+            cam.clip_ring.append((t0, cv2.resize(img, (CLIP_WIDTH, h * CLIP_WIDTH // w), interpolation=cv2.INTER_AREA)))
+            last_clip = t0
+        stats.add('capture', now_ms() - t0)
+        if active:
+            cam.frame_q.put((seq, t0, img))
+            frames_ready.set()
+        elif cam.display:
+            cam.display_q.put((img, None, None, None, None))
+
+
+def detect_stage(net, cameras, frames_ready, stats, stop):
+    # 2단계 : 모든 카메라가 공유하는 검출 스레드
+    # 검출이 필요한 카메라의 프레임을 모아 한 번의 forward로 처리하고, 나머지는 추적기로 박스 갱신
+    while not stop.is_set():
+        if not frames_ready.wait(0.1):
+            continue
+        frames_ready.clear()
+
+        pending = []
+        for cam in cameras:
+            item = cam.frame_q.get_nowait()
+            if item is None:
+                continue
+            seq, t_cap, img = item
+            t0 = now_ms()
+            gray = cv2.cvtColor(img, cv2.COLOR_BGR2GRAY)
+            moved = cam.motion.update(img)
+            cam.frames_since_detect += 1
+
+            if (cam.frames_since_detect >= DETECT_INTERVAL or moved) and len(pending) < MAX_BATCH:
+                pending.append((cam, item, gray))
+                continue
+
+            face_box = cam.tracker.update(gray)
+            stats.add('track', now_ms() - t0)
+            cam.track_q.put((seq, t_cap, img, face_box, cam.tracker.track_id, False))
+
+        if not pending:
+            continue
+
+        t0 = now_ms()
+        boxes = face_extractor_dnn_batch([item[2] for _, item, _ in pending], net)
+        stats.add('detect', now_ms() - t0)
+        stats.add_batch(len(pending))
+
+        for (cam, (seq, t_cap, img), gray), face_box in zip(pending, boxes):
+            cam.frames_since_detect = 0
+            if face_box is not None:
+                h, w = img.shape[:2]
+                face_box = clip_box(face_box, w, h)
+                cam.tracker.start(gray, face_box)
+            else:
+                cam.tracker.reset()
+            if cam.tracker.box is None:
+                face_box = None
+            cam.track_q.put((seq, t_cap, img, face_box, cam.tracker.track_id, True))
+
+        # 이번에 못 묶은 프레임이 남아 있으면 바로 다음 배치 처리
+        if any(len(cam.frame_q.items) for cam in cameras):
+            frames_ready.set()
+
+
+def recognize_stage(cam, models, stats, stop):
+    # 3단계 : 카메라별 인식 스레드, 트랙이 바뀌었거나 DNN이 새로 잡은 박스가 크게 달라졌을 때 재인식
+    # 판정 중에는 RECOG_VOTE_INTERVAL마다 다시 인식해서 표마다 다른 프레임의 인식 결과를 씀(같은 결과를 여러 표로 세지 않음)
+    decider = VoteDecider()
+    recog_track_id = -1     # 마지막으로 인식한 트랙 번호
+    recog_box = None        # 마지막으로 인식한 박스
+    recog_t = 0.0           # 마지막 인식 시각(ms)
+    min_score, min_score_name = 999, ""
+
+    while not stop.is_set():
+        item = cam.track_q.get()
+        if item is None:
+            continue
+        seq, t_cap, img, face_box, track_id, detected = item
+        t0 = now_ms()
+        display_string = None
+        status_text, status_color = None, None
 
-                        if min_score < 500:
-                            confidence = int(100 * (1 - (min_score) / 300))
-                            display_string = str(confidence) + '% ' + min_score_name
-                        else:
-                            display_string = "잠금 상태"
-
-                        if face_box is not None:
-                            x, y, x1, y1 = face_box
-                            cv2.rectangle(frame, (x, y), (x1, y1), (0, 255, 0), 2)
-
-                        cv2.putText(frame, display_string, (50, 50), cv2.FONT_HERSHEY_COMPLEX, 2, (0, 255, 0), 2)
-                        confidence_cnt += 1
-
-                        if confidence_cnt < 21:
-                            if confidence >= 85:
-                                cv2.putText(frame, "Unlocked - " + min_score_name, (50, 450), cv2.FONT_HERSHEY_COMPLEX, 3, (0, 255, 0), 2)
-                                confidence_suc += 1
-                            else:
-                                cv2.putText(frame, "Locked", (50, 450), cv2.FONT_HERSHEY_COMPLEX, 3, (0, 0, 255), 2)
-                                confidence_fai += 1
-                            
-                            if confidence_cnt == 20:
-                                if confidence_suc >= 15:
-                                    s.sendall(b'FR:room_201:success:')
-                                    print('a')
-                                    time.sleep(30)
-                                elif confidence_fai > 5:
-                                    current_time = get_current_time_str()
-                                    failed_img = f'{current_time}.jpg'
-                                    failed_img_path = join(stranger_dir, failed_img)
-                                    cv2.imwrite(failed_img_path, frame)
-                                    #print(f"Failed capture saved at: {failed_img}")
-                                    s.sendall(f'FR:room_201:failure:{failed_img}'.encode())
-                                    print('b')
-                                    time.sleep(10)
-                            
-                        else:
-                            confidence_suc = 0
-                            confidence_fai = 0
-                            confidence_cnt = 0
+        try:
+            confidence = 0
+            fresh = False   # 이 프레임에서 새로 인식함(표로 셈)
+
+            if face_box is not None:
+                x, y, x1, y1 = face_box
+                cam.face_ring.append((t_cap, (x1 - x) * (y1 - y), img))
+                voting = not decider.in_cooldown(t0)
+                if track_id != recog_track_id or recog_box is None or \
+                        (detected and box_iou(face_box, recog_box) < RECOG_IOU) or \
+                        (voting and t0 - recog_t >= RECOG_VOTE_INTERVAL * 1000.0):
+                    x, y, x1, y1 = face_box
+                    face = img[y:y1, x:x1]
+                    if face.size > 0:
+                        min_score, min_score_name = recognize_face(face, models)
+                        recog_track_id = track_id
+                        recog_box = face_box
+                        recog_t = t0
+                        fresh = True
+
+                if min_score < 500:
+                    confidence = int(100 * (1 - (min_score) / 300))
+                    display_string = str(confidence) + '% ' + min_score_name
+                else:
+                    display_string = "잠금 상태"
 
-                    if frame is not None:
-                        image_resized = cv2.resize(frame, (512, 600))  
+                if decider.in_cooldown(t0):
+                    status_text, status_color = "Wait", (255, 255, 0)
+                else:
+                    ok = confidence >= UNLOCK_CONFIDENCE
+                    if ok:
+                        status_text, status_color = "Unlocked - " + min_score_name, (0, 255, 0)
                     else:
-                        image_resized = np.zeros((600, 512, 3), dtype=np.uint8)  
-
-                    combined_frame = np.hstack((original_frame, image_resized))  
-                    cv2.imshow(window_name, combined_frame)  
+                        status_text, status_color = "Locked", (0, 0, 255)
+
+                    result = decider.add(t0, track_id, ok) if fresh else None
+                    if result is not None:
+                        t_dec = now_ms()
+                        votes, face_ms = decider.finish(t_dec, result)
+                        if result == "success":
+                            cam.send_q.put((cam.tag('success:').encode(), None, None))
+                        else:
+                            cam.send_q.put((None, 'failure', img))
+                        cam.end_session(result)
+                        # 판정별 지표 : 표(인식) 수, 첫 표부터 판정까지, 프레임 캡처부터 판정까지
+                        stats.add('decision', face_ms)
+                        print(f"[decision] room={cam.room} result={result} votes={votes} "
+                              f"face_to_decision_ms={face_ms:.0f} capture_to_decision_ms={t_dec - t_cap:.0f}")
+            else:
+                recog_box = None
+
+        except Exception as e:
+            print(f"Error: {str(e)}")
+
+        stats.add('recognize', now_ms() - t0)
+        if cam.display:
+            cam.display_q.put((img, face_box, display_string, status_text, status_color))
+
+
+def dhash(img):
+    # 지각 해시(dHash, 64비트) : 서버가 거의 같은 장면의 반복 캡처를 걸러내는 데 사용
+    small = cv2.resize(cv2.cvtColor(img, cv2.COLOR_BGR2GRAY), (9, 8), interpolation=cv2.INTER_AREA)
+    bits = (small[:, 1:] > small[:, :-1]).flatten()
+    value = 0
+    for b in bits:
+        value = (value << 1) | int(b)
+    return value
+
+
+def best_face_frame(cam, fallback):
+    # 최근 구간에서 얼굴이 가장 크게 잡힌 프레임, 없으면 전달받은 프레임
+    since = now_ms() - FACE_RING_SECONDS * 1000.0
+    best = None
+    for t, area, img in list(cam.face_ring):
+        if t >= since and (best is None or area > best[0]):
+            best = (area, img)
+    return best[1] if best is not None else fallback
+
+
+def encode_clip(frames):
+    # 링버퍼 프레임을 MJPEG AVI로 인코딩 (OpenCV는 메모리로 영상을 쓸 수 없어 임시 파일 사용)
+    if len(frames) == 0:
+        return b''
+    h, w = frames[0].shape[:2]
+    fd, path = tempfile.mkstemp(suffix='.avi')
+    os.close(fd)
+    try:
+        writer = cv2.VideoWriter(path, cv2.VideoWriter_fourcc(*'MJPG'), CLIP_FPS, (w, h))
+        if not writer.isOpened():
+            return b''
+        for f in frames:
+            writer.write(f)
+        writer.release()
+        with open(path, 'rb') as f:
+            return f.read()
+    finally:
+        os.remove(path)
+
+
+def send_image(sock, tag, status, img, clip_frames=()):
+    # 이미지 프레임 전송 : 헤더 "FR:room_X:image:<상태>:<크기>:<dHash>:<원본>,<썸네일s>,<썸네일m>,<영상>\n"
+    # + [4바이트 길이 + 데이터] 청크들 + 길이 0 청크, 데이터는 원본 JPEG 뒤에 썸네일 JPEG와 영상을 이어 붙임(실패한 부분은 0바이트)
+    ok, jpg = cv2.imencode('.jpg', img, [cv2.IMWRITE_JPEG_QUALITY, JPEG_QUALITY])
+    if not ok:
+        print("이미지 인코딩 실패")
+        return
+    parts = [jpg.tobytes()]
+    h, w = img.shape[:2]
+    for tw in THUMB_WIDTHS:
+        thumb = cv2.resize(img, (tw, max(1, h * tw // w)), interpolation=cv2.INTER_AREA)
+        ok, tjpg = cv2.imencode('.jpg', thumb, [cv2.IMWRITE_JPEG_QUALITY, THUMB_QUALITY])
+        parts.append(tjpg.tobytes() if ok else b'')
+    parts.append(encode_clip(clip_frames))
+    data = b''.join(parts)
+    sizes = ','.join(str(len(p)) for p in parts)
+    sock.sendall(tag(f'image:{status}:{len(data)}:{dhash(img):016x}:{sizes}\n').encode())
+    for i in range(0, len(data), IMAGE_CHUNK):
+        chunk = data[i:i + IMAGE_CHUNK]
+        sock.sendall(struct.pack('>I', len(chunk)) + chunk)
+    sock.sendall(struct.pack('>I', 0))
+    print(f"{status} 이미지를 서버로 전송했습니다 ({len(data)} bytes)")
+
+
+def send_stage(cam, stats, stop):
+    # 4단계 : 방별 서버 전송(이미지는 JPEG로 인코딩해서 같은 소켓으로 전송), 방 소켓 쓰기는 이 스레드만 수행
+    while not stop.is_set():
+        item = cam.send_q.get()
+        if item is None:
+            continue
+        msg, image_status, img = item
+        t0 = now_ms()
+        try:
+            if img is not None:
+                # 사건 직전 영상과 가장 잘 나온 얼굴 사진은 카메라를 멈추지 않고 링버퍼에서 만듦
+                clip = [f for _, f in list(cam.clip_ring)]
+                send_image(cam.sock, cam.tag, image_status, best_face_frame(cam, img), clip)
+            else:
+                cam.sock.sendall(msg + b'\n')
+        except (socket.error, cv2.error) as e:
+            print(f"전송 오류: {e}")
+        stats.add('send', now_ms() - t0)
+
+
+def draw_view(combined_frame, item):
+    # 화면 출력 : 한 번만 축소해서 원본/표시 영역에 나눠 쓰고, 표시는 축소된 좌표에 그림
+    img, face_box, display_string, status_text, status_color = item
+    disp_w, disp_h = DISPLAY_SIZE
+    h, w = img.shape[:2]
+    cv2.resize(img, (disp_w, disp_h), dst=combined_frame[:, :disp_w])
+    combined_frame[:, disp_w:] = combined_frame[:, :disp_w]
+    view = combined_frame[:, disp_w:]
+    if display_string is not None:
+        sx, sy = disp_w / w, disp_h / h
+        x, y, x1, y1 = face_box
+        cv2.rectangle(view, (int(x * sx), int(y * sy)), (int(x1 * sx), int(y1 * sy)), (0, 255, 0), 2)
+        cv2.putText(view, display_string, (40, 60), cv2.FONT_HERSHEY_COMPLEX, 1.6, (0, 255, 0), 2)
+        if status_text is not None:
+            cv2.putText(view, status_text, (40, 560), cv2.FONT_HERSHEY_COMPLEX, 2, status_color, 2)
+
+
+def run(models):
+    # DNN 모델은 프로세스에 하나만 두고 모든 카메라가 공유
+    net, _ = load_dnn_model()
+    cameras = load_cameras()
+
+    for cam in cameras:
+        cam.cap = cv2.VideoCapture(cam.source)
+        if not cam.cap.isOpened():
+            print(f"{cam.room}호 카메라를 열 수 없습니다.")
+            return
+        cam.cap.set(cv2.CAP_PROP_BUFFERSIZE, 1)  # 쉬는 동안 저속으로 읽어도 오래된 프레임이 쌓이지 않게
+
+    disp_w, disp_h = DISPLAY_SIZE
+    for cam in cameras:
+        if cam.display:
+            cv2.namedWindow(cam.window_name, cv2.WND_PROP_FULLSCREEN)
+            cv2.setWindowProperty(cam.window_name, cv2.WND_PROP_FULLSCREEN, cv2.WINDOW_NORMAL)
+            cv2.resizeWindow(cam.window_name, 1024, 600)
+            cam.canvas = np.zeros((disp_h, disp_w * 2, 3), dtype=np.uint8)
+
+    # 방마다 서버에 따로 접속, 다른 노드 담당 방이면 수신 스레드가 REDIRECT를 받아 다시 접속
+    for cam in cameras:
+        connect_room(cam, HOST, PORT)
+
+    stats = StageStats(['capture', 'detect', 'track', 'recognize', 'send', 'decision'])
+    stop = threading.Event()
+    frames_ready = threading.Event()
+
+    # 소켓 수신 스레드와 단계별 스레드 시작
+    stages = [(detect_stage, (net, cameras, frames_ready, stats, stop))]
+    for cam in cameras:
+        stages += [
+            (receive_socket_data, (cam,)),
+            (capture_stage, (cam, frames_ready, stats, stop)),
+            (recognize_stage, (cam, models, stats, stop)),
+            (send_stage, (cam, stats, stop)),
+        ]
+    for target, args in stages:
+        t = threading.Thread(target=target, args=args)
+        t.daemon = True 
+        t.start()
+
+    # 화면 출력은 메인 스레드에서만
+    last_report = time.time()
+    while not stop.is_set():
+        for cam in cameras:
+            item = cam.display_q.get_nowait()
+            if item is not None:
+                draw_view(cam.canvas, item)
+                cv2.imshow(cam.window_name, cam.canvas)  
+
+        if cv2.waitKey(10) == 13: 
+            break
 
-                except Exception as e:
-                    print(f"Error: {str(e)}")
+        if time.time() - last_report >= STATS_INTERVAL:
+            stats.report([q for cam in cameras for q in cam.queues()])
+            last_report = time.time()
 
-            if cv2.waitKey(1) == 13: 
-                break
+    stop.set()
 
-    cap.release()
+    for cam in cameras:
+        cam.sock.close()
+        cam.cap.release()
     cv2.destroyAllWindows()
 
 
 if __name__ == "__main__":
-    stranger_dir = "/home/choi/Desktop/smartdoorlock/images/"
-    if not exists(stranger_dir):
-        makedirs(stranger_dir)
     models = load_models()
     if len(models) == 0:
         print("학습된 모델이 없습니다. 먼저 모델을 학습시켜주세요.")
     else:
-        run(models, stranger_dir)
+        run(models)
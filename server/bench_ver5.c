@@ -0,0 +1,479 @@
+//  ֿ  ũκġũ : server_ver5.c ״ ؼ  Լ  ȣ
+//  : gcc -O2 bench_ver5.c -o bench -lpthread -lcrypto (DB Ʒ ޸ 鿣带 Ƿ -lmysqlclient )
+//  : ./bench [--filter ≮ Ϻ>] [--out < JSON>] (⺻ bench_ver5.json)
+//  JSON Google Benchmark  (benchmarks[].name/iterations/real_time/cpu_time), Ȯ   
+//   ˻(10/1000/100000), ESP/FR/WEB ޽  ó,   , DB (   ྿ +   db/baseline/*)
+#define main server_main
+#include "server_ver5.c"
+#undef main
+
+#define BENCH_MAX 64
+#define BENCH_MIN_TIME_NS 500000000LL // ׸񸶴 ּ  ð(0.5)
+#define BENCH_MAX_ITERS 100000000L
+#define BENCH_KEYS 1024               //  ˻    ȣ 
+#define BENCH_ROOM "201"              // ޽/ ġũ 
+#define BENCH_SUBSCRIBERS 16          // ̺Ʈ  ġũ  
+
+typedef struct BenchResult {
+    char name[64];
+    long iterations;
+    double real_ns;  // 1ȸ  ð
+    double cpu_ns;   // 1ȸ   CPU ð( ݴ/   )
+} BenchResult;
+
+typedef void (*BenchFn)(void* arg, long iters);
+
+// ޽ ó ġũ :     client_feed(  + ؼ + ó)
+typedef struct BenchMessage {
+    const char* name;
+    int type;
+    const char* line;
+} BenchMessage;
+
+BenchResult bench_results[BENCH_MAX];
+int bench_count = 0;
+const char* bench_filter = NULL;
+FILE* bench_report = NULL;  //  ǥ( ڵ printf /dev/null )
+MYSQL* bench_conn = NULL;
+Client* bench_clients[CLIENT_TYPE_WEB + 1];
+RoomNode* bench_room = NULL;
+char bench_keys[BENCH_KEYS][16];
+
+// ޸ DB 鿣 : libmysqlclient  ũ,    ΰ /  (Ʈũ, ũ )
+// SELECT LoginPW  йȣ "1234"   
+typedef struct MemDb {
+    char* last;            //  
+    size_t cap;
+    unsigned long queries;
+    unsigned long rows;    // INSERT   + UPDATE  
+    int result_rows;       // mysql_store_result   
+} MemDb;
+
+MemDb memdb;
+pthread_mutex_t memdb_mutex = PTHREAD_MUTEX_INITIALIZER;
+MYSQL memdb_conn;
+MYSQL_RES memdb_result;
+char* memdb_row[1] = { "1234" };
+
+MYSQL* mysql_init(MYSQL* mysql) {
+    return mysql ? mysql : &memdb_conn;
+}
+
+MYSQL* mysql_real_connect(MYSQL* mysql, const char* host, const char* user, const char* passwd, const char* db,
+    unsigned int port, const char* unix_socket, unsigned long clientflag) {
+    (void)host; (void)user; (void)passwd; (void)db; (void)port; (void)unix_socket; (void)clientflag;
+    return mysql;
+}
+
+int mysql_query(MYSQL* mysql, const char* q) {
+    (void)mysql;
+    size_t len = strlen(q);
+    pthread_mutex_lock(&memdb_mutex);
+    if (len + 1 > memdb.cap) {
+        memdb.cap = (len + 1) * 2;
+        memdb.last = (char*)realloc(memdb.last, memdb.cap);
+    }
+    memcpy(memdb.last, q, len + 1);
+    memdb.queries++;
+    if (strncmp(q, "INSERT", 6) == 0) {
+        for (const char* p = strstr(q, "('"); p; p = strstr(p + 2, "('")) memdb.rows++;
+    }
+    else if (strncmp(q, "UPDATE", 6) == 0) {
+        memdb.rows++;
+    }
+    memdb.result_rows = strncmp(q, "SELECT", 6) == 0;
+    pthread_mutex_unlock(&memdb_mutex);
+    return 0;
+}
+
+const char* mysql_error(MYSQL* mysql) {
+    (void)mysql;
+    return "";
+}
+
+void mysql_close(MYSQL* mysql) {
+    (void)mysql;
+}
+
+MYSQL_RES* mysql_store_result(MYSQL* mysql) {
+    (void)mysql;
+    return memdb.result_rows ? &memdb_result : NULL;
+}
+
+MYSQL_ROW mysql_fetch_row(MYSQL_RES* result) {
+    (void)result;
+    if (memdb.result_rows == 0) return NULL;
+    memdb.result_rows--;
+    return memdb_row;
+}
+
+void mysql_free_result(MYSQL_RES* result) {
+    (void)result;
+    memdb.result_rows = 0;
+}
+
+long long bench_clock_ns(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// ּ  ð ѱ  ݺ Ƚ ÷ ( ª  ),   
+void bench_run(const char* name, BenchFn fn, void* arg) {
+    if ((bench_filter && !strstr(name, bench_filter)) || bench_count == BENCH_MAX) {
+        return;
+    }
+    long iters = 1;
+    long long real_ns, cpu_ns;
+    while (1) {
+        long long real_start = bench_clock_ns(CLOCK_MONOTONIC);
+        long long cpu_start = bench_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        fn(arg, iters);
+        real_ns = bench_clock_ns(CLOCK_MONOTONIC) - real_start;
+        cpu_ns = bench_clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+        if (real_ns >= BENCH_MIN_TIME_NS || iters >= BENCH_MAX_ITERS) {
+            break;
+        }
+        // ּ ð  ѱ⵵ ø   2~10
+        double scale = real_ns > 0 ? 1.4 * BENCH_MIN_TIME_NS / real_ns : 10;
+        if (scale > 10) scale = 10;
+        if (scale < 2) scale = 2;
+        iters = (long)(iters * scale);
+        if (iters > BENCH_MAX_ITERS) iters = BENCH_MAX_ITERS;
+    }
+    BenchResult* r = &bench_results[bench_count++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->iterations = iters;
+    r->real_ns = (double)real_ns / iters;
+    r->cpu_ns = (double)cpu_ns / iters;
+    fprintf(bench_report, "%-36s %14.1f ns %14.1f ns %12ld\n", r->name, r->real_ns, r->cpu_ns, r->iterations);
+    fflush(bench_report);
+}
+
+int bench_write_json(const char* path, const char* executable) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror("bench result open fail");
+        return -1;
+    }
+    char date[64];
+    char host[256] = { 0 };
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    gethostname(host, sizeof(host) - 1);
+    fprintf(f, "{\n  \"context\": {\n");
+    fprintf(f, "    \"date\": \"%s\",\n    \"host_name\": \"%s\",\n    \"executable\": \"%s\",\n", date, host, executable);
+    fprintf(f, "    \"num_cpus\": %ld,\n    \"library_build_type\": \"release\"\n  },\n", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(f, "  \"benchmarks\": [\n");
+    for (int i = 0; i < bench_count; i++) {
+        BenchResult* r = &bench_results[i];
+        fprintf(f, "    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"iteration\",\n", r->name, r->name);
+        fprintf(f, "      \"repetitions\": 1,\n      \"repetition_index\": 0,\n      \"threads\": 1,\n");
+        fprintf(f, "      \"iterations\": %ld,\n      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\"\n    }%s\n",
+            r->iterations, r->real_ns, r->cpu_ns, i + 1 < bench_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return 0;
+}
+
+//  ݴ о  (/FR/ )
+void* bench_drain_thread(void* arg) {
+    int sock = (int)(intptr_t)arg;
+    char buf[RECV_BUF_SIZE];
+    while (read(sock, buf, sizeof(buf)) > 0) {
+    }
+    return NULL;
+}
+
+int bench_socket(void) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair fail");
+        exit(1);
+    }
+    pthread_t tid;
+    pthread_create(&tid, NULL, bench_drain_thread, (void*)(intptr_t)sv[1]);
+    pthread_detach(tid);
+    return sv[0];
+}
+
+//   1..n  ٽ (ġũ ̶ delete_room_node   ° )
+void bench_rooms(int n) {
+    pthread_mutex_lock(&room_table_mutex);
+    while (room_table) {
+        RoomNode* next = room_table->next;
+        pthread_mutex_destroy(&room_table->lock);
+        slab_free(&room_slab, room_table);
+        room_table = next;
+    }
+    pthread_mutex_unlock(&room_table_mutex);
+    for (int i = 1; i <= n; i++) {
+        char room_number[16];
+        snprintf(room_number, sizeof(room_number), "%d", i);
+        add_room_node(create_room_node(room_number));
+    }
+    unsigned int seed = 42; // ึ   
+    for (int k = 0; k < BENCH_KEYS; k++) {
+        snprintf(bench_keys[k], sizeof(bench_keys[k]), "%d", 1 + (int)(rand_r(&seed) % n));
+    }
+}
+
+void bench_find_room(void* arg, long iters) {
+    (void)arg;
+    for (long i = 0; i < iters; i++) {
+        if (!find_room_node(bench_keys[i % BENCH_KEYS])) abort();
+    }
+}
+
+void bench_find_room_miss(void* arg, long iters) {
+    (void)arg;
+    for (long i = 0; i < iters; i++) {
+        if (find_room_node("none")) abort();
+    }
+}
+
+void bench_owner_node(void* arg, long iters) {
+    (void)arg;
+    volatile int owner = 0;
+    for (long i = 0; i < iters; i++) {
+        owner += owner_node(bench_keys[i % BENCH_KEYS]);
+    }
+}
+
+// ó   ESP (open, activate_keypad, lockout, set_pw_hash...) ٷ ACK,   ǥ  ʵ
+void bench_ack_since(unsigned int first) {
+    for (unsigned int id = first; id != next_command_id; id++) {
+        resolve_command(id, BENCH_ROOM, CMD_ACK, NULL);
+    }
+}
+
+//  ĸó/ ̺Ʈ (ū, ߺ ġ) ó · :  濡     ڷδ  θ  
+void bench_reset_events(void) {
+    pthread_mutex_lock(&bench_room->lock);
+    bench_room->event_tokens = EVENT_BUCKET_SIZE;
+    memset(bench_room->last_event_ms, 0, sizeof(bench_room->last_event_ms));
+    pthread_mutex_unlock(&bench_room->lock);
+}
+
+void bench_message(void* arg, long iters) {
+    BenchMessage* m = (BenchMessage*)arg;
+    Client* c = bench_clients[m->type];
+    char buffer[RECV_BUF_SIZE];
+    size_t len = strlen(m->line);
+    for (long i = 0; i < iters; i++) {
+        bench_reset_events(); // Ź Ǵ ( û) 
+        memcpy(buffer, m->line, len); // client_feed  ȿ  ߶ 
+        unsigned int first = next_command_id;
+        client_feed(c, buffer, (int)len, bench_conn);
+        if (c->upload.active) end_image_upload(&c->upload);
+        bench_ack_since(first);
+    }
+}
+
+void bench_room_send(void* arg, long iters) {
+    (void)arg;
+    for (long i = 0; i < iters; i++) {
+        room_send(bench_room, TARGET_ESP, "open:1\n");
+    }
+}
+
+void bench_web_reply(void* arg, long iters) {
+    (void)arg;
+    for (long i = 0; i < iters; i++) {
+        web_reply(bench_clients[CLIENT_TYPE_WEB]->web, "1", "WEB:room_201:open:ack:1:20\n");
+    }
+}
+
+void bench_esp_command(void* arg, long iters) {
+    (void)arg;
+    for (long i = 0; i < iters; i++) {
+        unsigned int id = send_room_command(bench_room, "open", NULL, NULL, NULL, NULL);
+        resolve_command(id, BENCH_ROOM, CMD_ACK, NULL);
+    }
+}
+
+void bench_bus_publish(void* arg, long iters) {
+    (void)arg;
+    for (long i = 0; i < iters; i++) {
+        bus_publish(BUS_DOOR_OPENED, BENCH_ROOM, NULL);
+    }
+}
+
+void bench_save_image_path(void* arg, long iters) {
+    (void)arg;
+    for (long i = 0; i < iters; i++) {
+        save_image_path(bench_conn, "0f1e2d3c4b5a69788796a5b4c3d2e1f00f1e2d3c4b5a69788796a5b4c3d2e1f0", BENCH_ROOM);
+    }
+}
+
+void bench_change_password(void* arg, long iters) {
+    (void)arg;
+    for (long i = 0; i < iters; i++) {
+        change_password(bench_conn, "1234", BENCH_ROOM);
+    }
+}
+
+//  ( ڵ带 ġ ) :  Stranger INSERT ġũ  batch ྿    (1ȸ = 1)
+//    ྿ Ƿ   󸶳 پ , db/save_image_path 
+void bench_insert_batch(void* arg, long iters) {
+    int batch = *(int*)arg;
+    size_t cap = BUF_SIZE + (size_t)batch * BUF_SIZE;
+    char* query = (char*)malloc(cap);
+    long done = 0;
+    while (done < iters) {
+        int n = iters - done < batch ? (int)(iters - done) : batch;
+        size_t len = snprintf(query, cap, "INSERT INTO Stranger (RoomNO, Img_path) VALUES ");
+        for (int i = 0; i < n; i++) {
+            len += snprintf(query + len, cap - len, "%s('%s', '%s')", i ? ", " : "", BENCH_ROOM,
+                "0f1e2d3c4b5a69788796a5b4c3d2e1f00f1e2d3c4b5a69788796a5b4c3d2e1f0");
+        }
+        if (mysql_query(bench_conn, query)) abort();
+        done += n;
+    }
+    free(query);
+}
+
+//  main  ʱȭ(ť ó 常 ,  ð ʰ  ACK ٷ ó)
+void bench_init(void) {
+    pthread_mutex_init(&room_table_mutex, NULL);
+    pthread_mutex_init(&image_mutex, NULL);
+    pthread_mutex_init(&pending_mutex, NULL);
+    pthread_mutex_init(&web_conn_mutex, NULL);
+    pthread_cond_init(&web_idle, NULL);
+    pthread_mutex_init(&bus_mutex, NULL);
+    pthread_rwlock_init(&room_state_lock, NULL);
+    pthread_mutex_init(&forward_mutex, NULL);
+    pthread_cond_init(&forward_done, NULL);
+    pthread_mutex_init(&client_mutex, NULL);
+    pthread_mutex_init(&dispatch_mutex, NULL);
+    pthread_cond_init(&dispatch_ready, NULL);
+    pthread_mutex_init(&persist_mutex, NULL); //    (ٲ  ǥ 븸  )
+    signal(SIGPIPE, SIG_IGN);
+    char* args[] = { "bench", "9000" };
+    cluster_init(2, args);
+    bench_conn = mysql_init(NULL);
+    mysql_real_connect(bench_conn, server, user, password, database, 0, NULL, 0);
+    dispatch_start(); // ̹ /йȣ  ó 忡(   ʸ)
+}
+
+// ġũ (201) ESP/FR/WEB(Ʈ)  غ,   10
+void bench_connect(void) {
+    bench_rooms(10);
+    bench_room = create_room_node(BENCH_ROOM);
+    bench_room->esp_sock = bench_socket();
+    bench_room->fr_sock = bench_socket();
+    add_room_node(bench_room);
+    for (int type = CLIENT_TYPE_ESP; type <= CLIENT_TYPE_WEB; type++) {
+        Client* c = (Client*)slab_zalloc(&client_slab);
+        c->type = type;
+        c->hello_done = 1;
+        strcpy(c->room_number, BENCH_ROOM);
+        c->sock = type == CLIENT_TYPE_ESP ? bench_room->esp_sock : type == CLIENT_TYPE_FR ? bench_room->fr_sock : bench_socket();
+        if (type == CLIENT_TYPE_WEB) {
+            c->web = web_conn_open(c->sock, 1);
+        }
+        bench_clients[type] = c;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* out = "bench_ver5.json";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            bench_filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out = argv[++i];
+        }
+        else {
+            fprintf(stderr, "usage : %s [--filter <name>] [--out <result.json>]\n", argv[0]);
+            return 1;
+        }
+    }
+    bench_report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!bench_report || !freopen("/dev/null", "w", stdout)) {
+        perror("stdout redirect fail");
+        return 1;
+    }
+    bench_init();
+    fprintf(bench_report, "%-36s %17s %17s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+
+    //   ˻ :  Ʈ ü  +  Ž
+    static const int room_counts[] = { 10, 1000, 100000 };
+    for (int i = 0; i < 3; i++) {
+        char name[64];
+        bench_rooms(room_counts[i]);
+        snprintf(name, sizeof(name), "lookup/find_room_node/%d", room_counts[i]);
+        bench_run(name, bench_find_room, NULL);
+        snprintf(name, sizeof(name), "lookup/find_room_node_miss/%d", room_counts[i]);
+        bench_run(name, bench_find_room_miss, NULL);
+    }
+    //      (ؽ   Ž)
+    char* cluster_args[] = { "bench", "9000", "10.0.0.1:9000", "10.0.0.2:9000", "10.0.0.3:9000", "10.0.0.4:9000" };
+    cluster_init(6, cluster_args);
+    bench_run("lookup/owner_node/4", bench_owner_node, NULL);
+    cluster_init(2, cluster_args);
+
+    // ޽  ó,  Ű ޽(FR failure, auth_fail, wrong_password) 
+    bench_connect();
+    static BenchMessage messages[] = {
+        { "parse/esp/ack", CLIENT_TYPE_ESP, "ESP32:room_201:ack:7\n" },
+        { "parse/esp/nack", CLIENT_TYPE_ESP, "ESP32:room_201:nack:7:busy\n" },
+        { "parse/esp/auth_ok", CLIENT_TYPE_ESP, "ESP32:room_201:auth_ok:keypad\n" },
+        { "parse/esp/telemetry", CLIENT_TYPE_ESP, "ESP32:room_201:telemetry:10:52000:18000:-67:-72:0:0:3:1:0:0\n" },
+        { "parse/esp/session", CLIENT_TYPE_ESP, "ESP32:room_201:session:keypad\n" },
+        { "parse/fr/success", CLIENT_TYPE_FR, "FR:room_201:success\n" },
+        { "parse/fr/capture", CLIENT_TYPE_FR, "FR:room_201:capture:0f1e2d3c4b5a69788796a5b4c3d2e1f00f1e2d3c4b5a69788796a5b4c3d2e1f0\n" },
+        { "parse/fr/image_header", CLIENT_TYPE_FR, "FR:room_201:image:failure:1024:00ff00ff00ff00ff:1024\n" },
+        { "parse/web/ping", CLIENT_TYPE_WEB, "@1 WEB:ping\n" },
+        { "parse/web/alloc", CLIENT_TYPE_WEB, "@1 WEB:alloc\n" },
+        { "parse/web/dispatch", CLIENT_TYPE_WEB, "@1 WEB:dispatch\n" },
+        { "parse/web/status", CLIENT_TYPE_WEB, "@1 WEB:room_201:status\n" },
+        { "parse/web/login", CLIENT_TYPE_WEB, "@1 WEB:room_201:login:1234\n" },
+        { "parse/web/latency", CLIENT_TYPE_WEB, "@1 WEB:room_201:latency\n" },
+        { "parse/web/telemetry", CLIENT_TYPE_WEB, "@1 WEB:room_201:telemetry\n" },
+        { "parse/web/open", CLIENT_TYPE_WEB, "@1 WEB:room_201:open\n" },
+        { "parse/web/open_offline", CLIENT_TYPE_WEB, "@1 WEB:room_999:open\n" },
+        { "parse/web/change_PW", CLIENT_TYPE_WEB, "@1 WEB:room_201:change_PW:1234\n" },
+        { "parse/fr/failure", CLIENT_TYPE_FR, "FR:room_201:failure:0f1e2d3c4b5a69788796a5b4c3d2e1f00f1e2d3c4b5a69788796a5b4c3d2e1f0\n" },
+        { "parse/esp/auth_fail", CLIENT_TYPE_ESP, "ESP32:room_201:auth_fail:rfid\n" },
+        { "parse/esp/wrong_password", CLIENT_TYPE_ESP, "ESP32:room_201:wrong_password\n" },
+    };
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+        bench_run(messages[i].name, bench_message, &messages[i]);
+    }
+
+    //   :  ,  ,   + ACK ó, ̺Ʈ (Ʈ  1 / 16)
+    bench_run("write/room_send", bench_room_send, NULL);
+    bench_run("write/web_reply", bench_web_reply, NULL);
+    bench_run("write/esp_command", bench_esp_command, NULL);
+    bench_run("write/bus_publish/1", bench_bus_publish, NULL);
+    Subscriber* subs[BENCH_SUBSCRIBERS - 1];
+    int sub_socks[BENCH_SUBSCRIBERS - 1];
+    for (int i = 0; i < BENCH_SUBSCRIBERS - 1; i++) {
+        sub_socks[i] = bench_socket();
+        subs[i] = bus_subscribe(sub_socks[i], NULL, BUS_ALL_KINDS, "", DROP_OLDEST);
+    }
+    bench_run("write/bus_publish/16", bench_bus_publish, NULL);
+    for (int i = 0; i < BENCH_SUBSCRIBERS - 1; i++) {
+        bus_unsubscribe(subs[i]);
+        close(sub_socks[i]);
+    }
+
+    // DB  :   (̺Ʈ  ϳ), db/baseline/*   ڵ        
+    static int batches[] = { 1, 16, 128 };
+    bench_run("db/save_image_path", bench_save_image_path, NULL);
+    bench_run("db/change_password", bench_change_password, NULL);
+    for (int i = 0; i < 3; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "db/baseline/insert_batch/%d", batches[i]);
+        bench_run(name, bench_insert_batch, &batches[i]);
+    }
+
+    if (bench_write_json(out, argv[0]) < 0) {
+        return 1;
+    }
+    fprintf(bench_report, "%d results -> %s (db queries %lu, rows %lu)\n", bench_count, out, memdb.queries, memdb.rows);
+    return 0;
+}
@@ -3,14 +3,58 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <mysql/mysql.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+// ĸó/ ̺Ʈ (溰 ġ, ӵ ѿ)
+#define EVENT_CAPTURE_REQUEST 0 // ESP йȣ  -> FR ĸó û
+#define EVENT_FAILURE 1         // FR ν 
+#define EVENT_CAPTURE 2         // FR ĸó ̹
+#define EVENT_KIND_COUNT 3
 
 typedef struct RoomNode {
     char room_number[10];  //  ȣ
     int esp_sock;          // ESP32 
     int fr_sock;           // FR 
+    pthread_mutex_t lock;  // 溰 ؽ( , ̺Ʈ  ), ٸ  
+    double event_tokens;   // ĸó/ ̺Ʈ ū Ŷ
+    long long token_refill_ms;                 //  ū  ð
+    long long last_event_ms[EVENT_KIND_COUNT]; //   ó ð
+    unsigned int dropped_events;               // ġ/ӵ   ̺Ʈ 
+    long long cmd_rtt_last_ms;  // ESP  պ ð(  ~ ACK/NACK )
+    double cmd_rtt_avg_ms;      // պ ð ̵ 
+    long long cmd_rtt_max_ms;
+    unsigned int cmd_acked;     // ACK   
+    unsigned int cmd_nacked;    // NACK   
+    unsigned int cmd_timeouts;  //   ð ʰ  
+    unsigned int session_id;        //   ν (0̸ , FR  )
+    long long session_start_ms;     //   ð(ص SESSION_MAX_SECONDS  )
+    long long session_until_ms;     //   ð
+    long long session_sent_until_ms; // FR  ˸  ð
+    unsigned int sessions;          //   
+    int refs;              // room_node_hold/room_attach  , 0   Ͽ   (room_table_mutex)
+    int unlinked;          // Ͽ ,  room_node_release/room_detach 
     struct RoomNode* next; //   
 } RoomNode;
 
@@ -22,88 +66,955 @@ char* database = "SmartBuilding";
 
 RoomNode* room_table = NULL; //    
 pthread_mutex_t room_table_mutex; //  Ͽ  ؽ
-pthread_mutex_t capture_mutex; // ĸó û  ؽ
 
 #define BUF_SIZE 256
+#define RECV_BUF_SIZE 8192 // ̹   recv ۴ ũ
 #define PORT 9000
 
+// 溰 ĸó/ ̺Ʈ  :   COALESCE_MS ȿ  , ü ū Ŷ 
+#define COALESCE_MS 3000          //  ð    ̺Ʈ ϳ ħ
+#define EVENT_BUCKET_SIZE 5.0     //   ϴ ִ ̺Ʈ 
+#define EVENT_REFILL_PER_SEC 0.1  // ʴ Ǵ ū(10ʿ 1)
+
+// room_send  
+#define TARGET_ESP 1
+#define TARGET_FR 2
+
+//    (WEB:floor_3:open, WEB:building:open, WEB:rooms_201,202:open)
+#define FANOUT_THREADS 8         //    ô  
+#define FANOUT_PARALLEL_MIN 32   // ̺    忡 ٷ 
+
+// ESP  û/ :  -> ESP "<>:<ID>\n", ESP ->  "ESP32:room_X:ack:<ID>" Ǵ "ESP32:room_X:nack:<ID>:<>"
+#define MAX_PENDING_COMMANDS 4096  //  ٸ  (ID % ũ ڸ )
+#define COMMAND_TIMEOUT_MS 20000   //  (step)   ACK Ƿ ˳ϰ
+#define RTT_EWMA_WEIGHT 0.2        // պ ð ̵  ġ
+#define WEB_TAG_LEN 16             //  û ± ִ 
+
+//  
+#define CMD_PENDING 1
+#define CMD_ACK 0
+#define CMD_OFFLINE -1  //  / 
+#define CMD_NACK -2
+#define CMD_TIMEOUT -3
+
+// ̹  :  SHA-256  (IMAGE_STORE_DIR/2/ؽ.jpg), DB ؽø 
+#define IMAGE_STORE_DIR "/home/choi/Desktop/smartdoorlock/images"
+#define IMAGE_HASH_LEN 64                 // SHA-256 16 ڿ 
+#define MAX_IMAGE_SIZE (16 * 1024 * 1024) //   ޴ ִ ũ( +  + )
+#define IMAGE_PARTS 4                     // ,  (_s), ߰ (_m),   (_clip)
+#define RECENT_IMAGE_COUNT 64             //  ߺ Ǵܿ  ֱ ̹ 
+#define PHASH_MAX_DISTANCE 6              //  ؽ ع Ÿ  ϸ   Ǵ
+#define NEAR_DUP_SECONDS 600              //  ð    ̹͸ 
+
+//   忡   : ./server <Ʈ> <ڱ ּ:Ʈ> <ٸ  ּ:Ʈ> ...
+//  ȣ ؽ÷ ϰ ؽ   带 ϰ, ٸ   ESP/FR λ縻 "REDIRECT:<ּ>:<Ʈ>\n"
+// ٸ   WEB û   (WEB:peer , ± û)ؼ  ״ 
+#define MAX_CLUSTER_NODES 16
+#define RING_VNODES 64                                   //   ġ (  )
+#define MAX_FORWARDS 1024                                // ٸ    WEB û 
+#define FORWARD_TIMEOUT_MS (COMMAND_TIMEOUT_MS + 5000)   //   ESP ð ʰ 
+
+// ߴ  :   "./server --takeover < >"  ϸ   н (HANDOFF_PATH_FMT)
+//  ϰ  ESP/FR/WEB/SUB (SCM_RIGHTS),  ¸ ѱ , /FR   
+//    û ޱ⸦  ߰ ó   (ACK/ð ʰ)  б⸦   ѱ
+#define HANDOFF_PATH_FMT "/tmp/smartbuilding_%d.sock"
+#define HANDOFF_REC_LEN 1024       // ѱ ڵ   ִ (SOCK_SEQPACKET ޽ ϳ)
+#define HANDOFF_PARK_MS 5000       // б 尡 ߱⸦ ٸ ִ ð(̹  ̸  )
+#define HANDOFF_PHASE_WEB 1        //  û б , ó   
+#define HANDOFF_PHASE_ALL 2        //  б 
+
+//  /  : ũ  ϸ (mmap ) + WAL( )   ĳ,  ,  ¸ ٷ 
+// ٲ  PERSIST_WAL_MS  WAL   ڵ ü ߰(   ڵ尡 ֽ), ֱ    WAL 
+//   /FR ٽ ϱ  WEB status/login  DB  (  0,   unknown)
+#define STATE_DIR "/home/choi/Desktop/smartdoorlock/state"
+#define STATE_SNAP_FMT STATE_DIR "/rooms_%d.snap"     // Ʈ( ȣƮ  )
+#define STATE_WAL_FMT STATE_DIR "/rooms_%d.wal"
+#define PERSIST_WAL_MS 200                  // ٲ  WAL  ֱ(fdatasync )
+#define PERSIST_SNAPSHOT_MS 60000           //  ֱ
+#define PERSIST_WAL_MAX (4 * 1024 * 1024)   // WAL ̺ Ŀ ٷ 
+#define PERSIST_DIRTY_SLOTS 4096            //  ֱ⿡  ٲ  (2 ŵ,    )
+#define SNAP_MAGIC "SBSNAP1"
+#define WAL_MAGIC 0x314c4157u               // "WAL1"
+
+//  I/O  : ./server --io <threads|epoll|uring> ...
+// threads Ḷ (⺻), epoll/uring I/O  ϳ   ޾Ƽ Ằ  ۾ 忡 ѱ
+// uring HAVE_LIBURING(-DHAVE_LIBURING -luring, liburing 2.4 ̻)  , Ŀ   epoll
+#define IO_BACKEND_THREADS 0
+#define IO_BACKEND_EPOLL 1
+#define IO_BACKEND_URING 2
+#define IO_WORKERS 8              // ۾  ( DB  ϳ)
+#define IO_BATCH 256              // epoll_wait    ̺Ʈ 
+#define IO_URING_ENTRIES 4096     //  ť ũ
+#define IO_BUF_COUNT 512          // recv    (2 ŵ),  ũ RECV_BUF_SIZE
+#define IO_BUF_GROUP 1
+#define IO_TAG_ACCEPT 1           // io_uring Ϸ (   Client )
+#define IO_TAG_WAKE 2
+#define IO_TAG_CANCEL 3
+
+// ۾ 
+#define IO_JOB_DATA 0     //  (ù ʹ λ縻)
+#define IO_JOB_RESUME 1   //  Ѱܹ  λ縻
+#define IO_JOB_PARK 2     //  : б⸦  ѱ غ
+#define IO_JOB_CLOSE 3    //  
+
+// ޽ ó 켱 :   (open, activate_keypad, failure, lockout)  忡 ٷ ESP 
+// ̹ /DB , йȣ  Ŭ ť ־ ó 尡  Ŭ ó(   ٸ )
+// Ŭ   : ѱ late ,  ѱ  Ŭ ۾  Ŭ    ʰ 
+#define PRIO_DOOR 0               //   : ť  ٷ(  ESP ۱ ð  )
+#define PRIO_ADMIN 1              // йȣ , ī ߰/(DB    )
+#define PRIO_LOG 2                // ħ/ĸó ̹ , DB INSERT, ̺Ʈ 
+#define PRIO_COUNT 3
+#define DISPATCH_WORKERS 2        // ť ó  ( DB  ϳ)
+#define DISPATCH_QUEUE_MAX 1024   // Ŭ ִ  ۾ (ġ  dropped )
+#define DISPATCH_NICE 10          // ó  nice (CPU     )
+
+// ť ۾ 
+#define TASK_LOG_IMAGE 0          // ̹ ؽ DB  + ħ/ĸó ̺Ʈ
+#define TASK_STORE_UPLOAD 1       //  ̹   
+#define TASK_CHANGE_PW 2          // йȣ    
+#define TASK_CARD 3               // ī ߰/   
+
 // Ŭ̾Ʈ Ÿ 
 #define CLIENT_TYPE_ESP 1
 #define CLIENT_TYPE_FR 2
 #define CLIENT_TYPE_WEB 3
+#define CLIENT_TYPE_SUB 4
+
+// ̺Ʈ  :  ȿ ߻  ̺Ʈ (SUB ,  Ʈ) 
+//  λ縻 "SUB:<,|all>:< ȣ|all>:<drop_oldest|drop_newest|disconnect>" (  )
+//  "EVENT:room_X:<>[:<>]\n", ť   ̺Ʈ  "EVENT:bus:dropped:<>\n"
+#define BUS_CONNECTED 0         // ESP/FR ( esp|fr)
+#define BUS_DISCONNECTED 1      // ESP/FR  ( esp|fr)
+#define BUS_DOOR_OPENED 2       //    ACK
+#define BUS_WRONG_PASSWORD 3    // йȣ/RFID 5ȸ 
+#define BUS_INTRUDER 4          // ν  ̹( ؽ)
+#define BUS_CAPTURED 5          // ĸó ̹( ؽ)
+#define BUS_PASSWORD_CHANGED 6  //  йȣ 
+#define BUS_LOCKED_OUT 7        //    (  )
+#define BUS_KIND_COUNT 8
+#define BUS_ALL_KINDS ((1u << BUS_KIND_COUNT) - 1)
+
+#define ROOM_STATE_BUCKETS 1024  //   ĳ ؽ Ŷ 
+
+//    : 溰,  ܺ ֱ LOCKOUT_WINDOW_MS       
+// ESP õ "ESP32:room_X:auth_fail:<keypad|rfid>" / "auth_ok:<keypad|rfid>", FR ν /  
+#define CRED_KEYPAD 0
+#define CRED_RFID 1
+#define CRED_FACE 2
+#define CRED_COUNT 3
+#define LOCKOUT_MAX_FAILS 5        //      
+#define LOCKOUT_MAX_TOTAL 8        //    հ   
+#define LOCKOUT_WINDOW_MS 60000    // и  (̵ )
+#define LOCKOUT_BUCKETS 12         //   ĭ (5 )
+#define LOCKOUT_MS 60000           //  ð
+#define LOCKOUT_SLOTS 4096         //  ¸   ִ  (2 ŵ)
+
+// (ESP)   : RFID ī (DB Card ̺) Ʈ йȣ ؽø  ¿ ΰ, ESP   NVS ؼ   ٷ 
+// ٲ  溰  1 ø ֱ  , ESP ϸ "ESP32:room_X:sync:<>"   ˸
+//    游  : uid_add:<UID>:<> / uid_del:<UID>:<> / pw_salt:<Ʈ>:<ؽ>:<> (ESP  ̾  )
+// Ͽ  ̸ ü : cred_reset, uid_add:<UID>:0 ..., pw_salt:<Ʈ>:<ؽ>:0,  cred_ver:<>
+#define CRED_MAX_UIDS 32           // 溰 ִ ī 
+#define CRED_UID_LEN 20            // UID 16 ִ (10Ʈ UID)
+#define CRED_SALT_LEN 32           // Ʈ 16 (16Ʈ)
+#define CRED_LOG_MAX 16            // 溰 ϴ ֱ  
+#define CRED_CMD_LEN 128           //      ִ 
+#define CRED_OP_PW 0
+#define CRED_OP_UID_ADD 1
+#define CRED_OP_UID_DEL 2
+
+// ESP   : ESP 10   ũ ڵ带  1и Ƽ ( ٿ ڵ ϳ)
+// "ESP32:room_X:telemetry:<  >:<loop >:<loop ִ  us>:<RSSI >:<RSSI ּ>:<>:< >:<Ű Է>:<RFID б>:< >:<  ִ ms>"
+//  溰   ĭ(ֱ TELEMETRY_SLOTS) ħ, ޸𸮿 (ϸ )
+#define TELEMETRY_SLOTS 60         // 溰 ϴ  
+#define TELEMETRY_WORST 10         // WEB:telemetry  ִ    
+
+// ν  : FR ҿ ( ĸó)  ȸ /ν 
+// ESP ->  "ESP32:room_X:session:<>"( Űе ġ ),  "WEB:room_X:session[:<>]", "WEB:room_X:session_stop"
+//  -> FR "FR:room_X:session_start:<ID>:<>\n", "FR:room_X:session_stop:<ID>\n"
+// FR ->  "FR:room_X:session_end:<ID>:<success|failure|timeout|stopped>"
+#define SESSION_SECONDS 20         // ⺻  ()
+#define SESSION_MAX_SECONDS 120    // ص    ð
+#define SESSION_RESEND_MS 5000     //      ð ̸ŭ þ  FR ٽ ˸
+
+#define BUS_QUEUE_SIZE 256      // ں ť ũ
+#define BUS_LINE_LEN 128        // ̺Ʈ   ִ 
+#define BUS_WRITE_BATCH 32      //   write  ִ ̺Ʈ 
+
+//  ť  á 
+#define DROP_OLDEST 0    //   ̺Ʈ (⺻)
+#define DROP_NEWEST 1    //  ̺Ʈ 
+#define DROP_DISCONNECT 2 //  ϴ   
+
+//    溰 ,      ȣ ٽ ã(   ų ٽ   )
+typedef struct FanoutTarget {
+    char room_number[10];
+    int result;          // 0 :  , -1 : /̿
+} FanoutTarget;
+
+//     
+typedef struct GroupWait {
+    int remaining;         //      
+    pthread_cond_t done;   // remaining 0 Ǹ ȣ(pending_mutex  )
+} GroupWait;
+
+typedef struct FanoutJob {
+    FanoutTarget* targets;
+    int begin;
+    int end;
+    const char* msg;
+    GroupWait* group;
+} FanoutJob;
+
+//      (CRED_OP_*)
+typedef struct CredChange {
+    int op;
+    char uid[CRED_UID_LEN + 1];  // CRED_OP_UID_*  ī(йȣ    )
+} CredChange;
+
+// 溰 ESP   1 ĭ
+typedef struct TelemetrySlot {
+    long long minute;             // н ð (ĭ ٽ   )
+    unsigned int records;
+    unsigned int loops;
+    unsigned int loop_max_us;
+    int rssi_sum;                 // ڵ RSSI  (Wi-Fi   ڵ )
+    unsigned int rssi_count;
+    int rssi_min;                 // 0̸  
+    unsigned int reconnects;
+    unsigned int conn_fails;
+    unsigned int keys;
+    unsigned int rfid_reads;
+    unsigned int opens;
+    unsigned int door_max_ms;
+} TelemetrySlot;
+
+//   ĳ : йȣ ؽ, ī ,  Ƚ,  ̺Ʈ,  ¸ ޸𸮿 ΰ ȸ DB  ó
+// йȣ/ī DB(Owner.LoginPW, Card)   ϸ ĳ   (ESP)  (write-through)
+//  (RoomNode)     ĳô   ִ  
+typedef struct RoomState {
+    char room_number[10];
+    int pw_loaded;                        // DB йȣ о(ϸ  ȸ  ٽ õ)
+    char pw_hash[IMAGE_HASH_LEN + 1];     // SHA-256(йȣ) 16
+    int esp_online;
+    int fr_online;
+    const char* door;                     // "locked", "opening", "unknown"
+    long long last_open_ms;               // н ð ms
+    unsigned int open_count;
+    unsigned int wrong_password_count;    // Űе/RFID 5ȸ  ˸ 
+    unsigned int intruder_count;
+    int last_event;                       // BUS_* (-1̸ )
+    long long last_event_ms;
+    char last_image[IMAGE_HASH_LEN + 1];  //  ħ/ĸó ̹ ؽ
+    char pw_salt[CRED_SALT_LEN + 1];      //   ؽ Ʈ(йȣ ٲ  )
+    char pw_salted[IMAGE_HASH_LEN + 1];   // SHA-256(Ʈ + йȣ) 16
+    int uids_loaded;                      // DB ī  о
+    int uid_count;
+    char uids[CRED_MAX_UIDS][CRED_UID_LEN + 1];  // ī UID 16(빮)
+    uint32_t cred_version;                //   (ó   ð , ٲ  1)
+    uint32_t cred_log_base;               //      
+    CredChange cred_log[CRED_LOG_MAX];    //  % CRED_LOG_MAX ڸ
+    TelemetrySlot* telemetry;             //  % TELEMETRY_SLOTS ڸ, ù ڵ带  Ҵ
+    struct RoomState* next;               //  Ŷ  
+} RoomState;
+
+RoomState* room_states[ROOM_STATE_BUCKETS];
+pthread_rwlock_t room_state_lock;  //  ĳÿ  б/ 
+
+// 溰   ī,  (atomic) ؼ ESP/FR 尡  ٸ 
+// ĭ ϳ (ĭ ȣ << 20 |  ), ĭ ȣ ٲ  ĭ  
+typedef struct AttemptSlot {
+    _Atomic uint64_t key;                                  //  ȣ ؽ(0̸  ڸ)
+    _Atomic uint64_t buckets[CRED_COUNT][LOCKOUT_BUCKETS];
+    _Atomic long long locked_until_ms;                     // now_ms , 0̸  ƴ
+    _Atomic unsigned int lockouts;                         //   Ƚ
+} AttemptSlot;
+
+AttemptSlot attempt_slots[LOCKOUT_SLOTS];
+
+// /WAL  ڵ( ũ), ð  н ð ms
+typedef struct SnapRecord {
+    char room_number[10];
+    char door[10];
+    int pw_loaded;
+    char pw_hash[IMAGE_HASH_LEN + 1];
+    char last_image[IMAGE_HASH_LEN + 1];
+    int last_event;
+    unsigned int open_count;
+    unsigned int wrong_password_count;
+    unsigned int intruder_count;
+    long long last_open_ms;
+    long long last_event_ms;
+    long long locked_until_ms;   // 0̸  ƴ
+    unsigned int lockouts;
+    unsigned int cmd_acked;
+    unsigned int cmd_nacked;
+    unsigned int cmd_timeouts;
+    long long cmd_rtt_last_ms;
+    long long cmd_rtt_max_ms;
+    double cmd_rtt_avg_ms;
+    char pw_salt[CRED_SALT_LEN + 1];
+    char pw_salted[IMAGE_HASH_LEN + 1];
+    int uids_loaded;
+    int uid_count;
+    char uids[CRED_MAX_UIDS][CRED_UID_LEN + 1];
+    uint32_t cred_version;       // ϸ     (ESP  ٸ ü ȭ)
+} SnapRecord;
+
+//   :  +  ڵ 迭
+typedef struct SnapHeader {
+    char magic[8];
+    uint32_t count;
+    uint32_t record_size;        // sizeof(SnapRecord), ü ٲ   
+    uint64_t seq;                //  Ե  WAL ȣ( ȣ WAL ڵ ǳʶ)
+    long long saved_ms;
+    uint64_t sum;                // ڵ 迭 FNV-1a
+} SnapHeader;
+
+typedef struct WalRecord {
+    uint32_t magic;
+    uint32_t record_size;
+    uint64_t seq;
+    uint64_t sum;                // seq + room  FNV-1a( ߸ ڵ Ȯ)
+    SnapRecord room;
+} WalRecord;
+
+int persist_port = 0;
+int persist_wal_fd = -1;         // -1̸  
+uint64_t persist_seq = 0;        //  WAL ڵ ȣ( 常 )
+long long persist_wal_bytes = 0;
+pthread_mutex_t persist_mutex;   // ٲ  Ͽ  ؽ
+char persist_dirty[PERSIST_DIRTY_SLOTS][10];
+int persist_dirty_count = 0;
+int persist_overflow = 0;        // ٲ  ʹ  :  ֱ⿡ 
+const char* cred_name[CRED_COUNT] = { "keypad", "rfid", "face" };
+
+// ̺Ʈ  , ť ڿ  尡 (lock)
+typedef struct Subscriber {
+    int sock;
+    pthread_mutex_t* write_lock;  //  ٸ    ؽ( Ʈ̴   write_lock), ƴϸ NULL
+    unsigned int kinds;           //  ̺Ʈ  Ʈ
+    char room_number[10];         //    
+    int policy;                   // DROP_*
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    char queue[BUS_QUEUE_SIZE][BUS_LINE_LEN];
+    int head;
+    int count;
+    unsigned int dropped;         //  ˸   ̺Ʈ 
+    unsigned int dropped_total;
+    int closing;
+    int paused;                   //   :  带 ߰ ̺Ʈ ť 
+    pthread_t writer;
+    struct Subscriber* next;
+} Subscriber;
+
+Subscriber* subscribers = NULL;
+pthread_mutex_t bus_mutex;  //  Ͽ  ؽ
+const char* bus_kind_name[BUS_KIND_COUNT] = {
+    "connected", "disconnected", "door_opened", "wrong_password", "intruder", "captured", "password_changed", "locked_out"
+};
+
+//   :   ±  û   ÿ óϰ(  ), Ʈ ῡ ̺Ʈ Ǫ
+// û "@<±> WEB:room_X:open\n" ->  "@<±> WEB:room_X:open:ack:<ID>:<ms>\n" (±   )
+// Ǫ "EVENT:room_X:<̺Ʈ>[:<>]\n" (λ縻 WEB:gateway  Ḹ, ̺Ʈ    )
+typedef struct WebConn {
+    int sock;
+    int gateway;             //  Ǫø ޴ 
+    int peer;                // ٸ  尡  û(ٽ  )
+    Subscriber* sub;         // gateway  ̺Ʈ  
+    int inflight;            //     ۾ (0    )
+    pthread_mutex_t write_lock; //   (, ̺Ʈ Ǫ) :    ٸ    
+    struct WebConn* next;
+} WebConn;
+
+WebConn* web_conns = NULL;   //   (web_conn_mutex)
+pthread_cond_t web_idle;     // inflight  ˸
+
+// Ŭ 
+typedef struct ClusterNode {
+    char host[64];
+    int port;
+    char addr[80];           // "ּ:Ʈ",  ؽÿ 
+    int sock;                // ޿ (-1̸  )
+    pthread_mutex_t lock;    // /
+} ClusterNode;
+
+typedef struct RingPoint {
+    uint64_t hash;
+    int node;
+} RingPoint;
+
+ClusterNode cluster_nodes[MAX_CLUSTER_NODES];
+int cluster_count = 1;   //    ȥڼ   
+int self_node = 0;
+RingPoint ring[MAX_CLUSTER_NODES * RING_VNODES];
+int ring_size = 0;
+
+// ٸ   WEB û,  "@f<ID> ..."   Ϸ
+typedef struct ForwardRequest {
+    unsigned int id;         // 0̸  ڸ
+    int node;
+    WebConn* web;            //  ٷ   (inflight ϳ  ), NULL̸ forward_wait ٸ
+    char tag[WEB_TAG_LEN];
+    char room_number[10];    //    offline 
+    char status[32];
+    long long sent_ms;
+    int done;
+    char* reply;             // forward_wait (и NULL)
+} ForwardRequest;
+
+ForwardRequest forwards[MAX_FORWARDS];
+unsigned int next_forward_id = 1;
+pthread_mutex_t forward_mutex;
+pthread_cond_t forward_done;
+
+//  Ŭ̾Ʈ(ߴ   ϰ λ縻   ѱ)
+typedef struct ClientConn {
+    pthread_t tid;
+    int sock;
+    int type;
+    char hello[BUF_SIZE];    //    λ縻  ó ̾
+    int parked;              // б⸦ ߰ ѱ غ 
+    struct ClientConn* next;
+} ClientConn;
+
+// Ŭ̾Ʈ   , hello  Ѱܹ (λ縻 ٽ  )
+typedef struct ClientStart {
+    int sock;
+    char hello[BUF_SIZE];
+    struct ClientStart* next;
+} ClientStart;
+
+ClientConn* client_conns = NULL;
+pthread_mutex_t client_mutex;
+pthread_cond_t handoff_resume; // ѱ  :  б 带 (client_mutex  )
+_Atomic int handoff_phase = 0;
+
+//    (庰  ġ)
+typedef struct GroupResult {
+    int ok;
+    int fail;
+    int timeouts;
+    long long ms;
+    char* failed;            //    "201,202"
+    char* down;              //    
+} GroupResult;
+
+//  óϴ    û
+typedef struct GroupRequest {
+    WebConn* web;
+    char tag[WEB_TAG_LEN];
+    char group[BUF_SIZE];
+    char status[BUF_SIZE];
+} GroupRequest;
+
+// ESP ACK/NACK ٸ 
+typedef struct PendingCommand {
+    unsigned int id;         // 0̸  ڸ
+    char room_number[10];
+    char command[CRED_CMD_LEN]; // pw_salt:<Ʈ>:<ؽ>:<> 
+    long long sent_ms;
+    WebConn* web;            //    (NULL̸ ),   inflight ϳ  
+    char tag[WEB_TAG_LEN];   //  û ±
+    GroupWait* group;        //   ̸  
+    FanoutTarget* target;    //       ڸ
+} PendingCommand;
+
+PendingCommand pending_commands[MAX_PENDING_COMMANDS];
+unsigned int next_command_id = 1;
+pthread_mutex_t pending_mutex;   //   Ͽ  ؽ
+pthread_mutex_t web_conn_mutex; //   ϰ inflight(  Ḷ write_lock)
+
+// FR ̹  
+//  "FR:room_X:image:<>:<ü ũ>\n"  [4Ʈ (򿣵) + ] ûũ,  0 ûũ 
+typedef struct ImageUpload {
+    int active;              // ̹   
+    char status[32];         // failure Ǵ capture
+    size_t expected;         //   ü ũ
+    size_t received;         // ݱ   ũ
+    uint32_t chunk_left;     //  ûũ  Ʈ
+    unsigned char len_buf[4];
+    int len_have;            // ûũ  ʵ带  Ʈ ޾Ҵ
+    int done;                //  ûũ 
+    int discard;             // ũ ʰ :  ûũ а 
+    int error;               //  
+    int has_phash;           //  ؽ(dHash)  ִ
+    uint64_t phash;
+    int part_count;          //  +  +  
+    size_t part_len[IMAGE_PARTS];
+    unsigned char* data;
+} ImageUpload;
+
+//  ϳ ó  : threads   尡, ̺Ʈ  I/O (б) ۾ (ó) 
+typedef struct Client {
+    int sock;
+    int type;
+    char room_number[10];
+    int hello_done;
+    ImageUpload upload;
+    char header[BUF_SIZE];   //   recv   ̹ /Ʈ û
+    WebConn* web;
+    Subscriber* sub;
+    ClientConn* self;
+    RoomNode* node;          // ESP/FR :   (room_attach  ΰ client_finish )
+    int worker;              // ̺Ʈ  : ó ۾ (Ḷ )
+    int reading;             // ̺Ʈ  : I/O 尡 д (ų  ߸ 0)
+    int stopped;             // ̺Ʈ  :  б⸦ (io_uring recv Ұ  ), ѱ⿡ ϸ ٽ 
+    int closing;             // λ縻 ó  (ٸ  ȳ )
+    struct Client* prev;     // I/O   
+    struct Client* next;
+} Client;
+
+// ̺Ʈ  ۾(I/O  -> ۾ )
+typedef struct IoJob {
+    Client* client;
+    int kind;                // IO_JOB_*
+    int len;
+    struct IoJob* next;
+    char data[];             // len + 1 Ʈ
+} IoJob;
+
+typedef struct IoWorker {
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    IoJob* head;
+    IoJob* tail;
+    MYSQL* conn;
+} IoWorker;
+
+// 켱 ť ۾(  -> ó )
+typedef struct DispatchTask {
+    int prio;                 // PRIO_*
+    int kind;                 // TASK_*
+    long long queued_ms;
+    char room_number[10];
+    char value[BUF_SIZE];     // ̹ ؽ,  йȣ Ǵ ī UID
+    int bus_kind;             //    ̺Ʈ(BUS_INTRUDER, BUS_CAPTURED)
+    int add;                  // TASK_CARD : 1̸ ߰, 0̸ 
+    ImageUpload upload;       // TASK_STORE_UPLOAD :  ̹(͸ Ѱܹ޾ ó 尡 )
+    WebConn* web;             // TASK_CHANGE_PW, TASK_CARD :   (hold)
+    char tag[WEB_TAG_LEN];
+    struct DispatchTask* next;
+} DispatchTask;
+
+// Ŭ ť (dispatch_mutex), PRIO_DOOR ť  踸
+typedef struct DispatchQueue {
+    DispatchTask* head;
+    DispatchTask* tail;
+    int count;
+    unsigned long done;
+    unsigned long late;       //      ѱ 
+    unsigned long dropped;    // ť    
+    long long max_ms;
+} DispatchQueue;
+
+DispatchQueue dispatch_queues[PRIO_COUNT];
+pthread_mutex_t dispatch_mutex;
+pthread_cond_t dispatch_ready;
+int dispatch_busy = 0;        // ó 尡   ۾ 
+const long long prio_budget_ms[PRIO_COUNT] = { 50, 1000, 10000 };
+const char* prio_name[PRIO_COUNT] = { "door", "admin", "log" };
+
+int io_backend = IO_BACKEND_THREADS;
+IoWorker io_workers[IO_WORKERS];
+Client* io_clients = NULL;       // I/O 常 
+unsigned int io_next_worker = 0;
+int io_listen_sock = -1;
+int io_epoll_fd = -1;
+int io_wake_fd = -1;             //  ܰ  ˸(eventfd)
+
+//  ũ ü Ǯ : ûũ(SLAB_CHUNK_BYTES)   Ҵϰ  ü  Ͽ ξٰ (ûũ ȯ )
+//  Ƶ malloc/free ݺ ʰ,   ۴ 0 ä ʰ ״ 
+#define SLAB_CHUNK_BYTES (64 * 1024)
+#define SLAB_INIT(name, size) { name, size, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0, 0 }
+
+typedef struct Slab {
+    const char* name;
+    size_t size;
+    pthread_mutex_t lock;
+    void* free_list;         //  ü (ü պκп   )
+    unsigned long allocs;    //  Ҵ 
+    unsigned long frees;     //   
+    unsigned long in_use;    //   ü 
+    unsigned long peak;      // ִ  
+    unsigned long chunks;    // malloc  ûũ 
+} Slab;
+
+Slab room_slab = SLAB_INIT("room", sizeof(RoomNode));
+Slab client_slab = SLAB_INIT("client", sizeof(Client));
+Slab client_conn_slab = SLAB_INIT("client_conn", sizeof(ClientConn));
+Slab client_start_slab = SLAB_INIT("client_start", sizeof(ClientStart));
+Slab web_slab = SLAB_INIT("web", sizeof(WebConn));
+Slab io_job_slab = SLAB_INIT("io_buf", sizeof(IoJob) + RECV_BUF_SIZE + 1);  // ̺Ʈ  recv 
+Slab task_slab = SLAB_INIT("task", sizeof(DispatchTask));
+Slab* slabs[] = { &room_slab, &client_slab, &client_conn_slab, &client_start_slab, &web_slab, &io_job_slab, &task_slab };
+
+// ֱ  ̹  ؽ(溰),  ħڸ ݺ ĸó   ٽ  ʱ  
+typedef struct RecentImage {
+    char room_number[10];
+    uint64_t phash;
+    time_t stored_at;
+    char hash[IMAGE_HASH_LEN + 1];
+} RecentImage;
+
+RecentImage recent_images[RECENT_IMAGE_COUNT];
+int recent_image_next = 0;
+pthread_mutex_t image_mutex; // ֱ ̹ Ͽ  ؽ
+const char* image_part_suffix[IMAGE_PARTS] = { ".jpg", "_s.jpg", "_m.jpg", "_clip.avi" };
 
 //Լ 
 RoomNode* create_room_node(const char* room_number);
 RoomNode* find_room_node(const char* room_number);
 void add_room_node(RoomNode* new_node);
-void delete_room_node(const char* room_number);
+int room_number_valid(const char* room_number);
+int room_list_valid(const char* list);
+RoomNode* room_attach(const char* room_number, int client_type, int client_sock);
+void room_detach(RoomNode* node, int client_type, int client_sock);
+RoomNode* room_node_hold(const char* room_number);
+void room_node_release(RoomNode* node);
+void room_node_free(RoomNode* node);
 void handle_message(const char* room_number, int client_sock, char* message, MYSQL* conn, int client_type);
-void handle_web_message(int client_sock, char* message, MYSQL* conn);
+void handle_web_message(WebConn* web, char* message, MYSQL* conn);
+void handle_group_message(WebConn* web, const char* tag, const char* group, const char* status);
+void* group_request_thread(void* arg);
+int collect_group_rooms(const char* group, FanoutTarget** out);
+void* fanout_worker(void* arg);
+void fanout_command(FanoutTarget* targets, int count, const char* msg);
+void fanout_parallel(FanoutTarget* targets, int count, const char* msg, GroupWait* group);
 void* client_handler(void* arg);
+int client_hello(Client* c, char* buffer, int len, MYSQL* conn, int resumed);
+void client_feed(Client* c, char* buffer, int bytes_received, MYSQL* conn);
+int client_idle(Client* c);
+void client_finish(Client* c);
 void save_image_path(MYSQL* conn, const char* image_path, const char* room_number);
-void change_password(MYSQL* conn, const char* pw, const char* room_number);
+int change_password(MYSQL* conn, const char* pw, const char* room_number);
+int change_card(MYSQL* conn, const char* uid, const char* room_number, int add);
+int begin_image_upload(ImageUpload* up, const char* header);
+int feed_image_upload(ImageUpload* up, const char* data, int len);
+void end_image_upload(ImageUpload* up);
+int store_image(const unsigned char* data, size_t len, char* hash_out);
+int store_upload(const char* room_number, ImageUpload* up, char* hash_out);
+int write_store_file(const char* hash, const char* suffix, const unsigned char* data, size_t len);
+int find_near_duplicate(const char* room_number, uint64_t phash, char* hash_out);
+void remember_image(const char* room_number, uint64_t phash, const char* hash);
+long long now_ms(void);
+long long epoch_ms(void);
+int allow_room_event(RoomNode* node, int kind);
+int room_send(RoomNode* node, int target, const char* msg);
+unsigned int send_room_command(RoomNode* node, const char* command, WebConn* web, const char* tag, GroupWait* group, FanoutTarget* target);
+void resolve_command(unsigned int id, const char* room_number, int result, const char* reason);
+void cancel_web_commands(WebConn* web);
+void* command_timeout_thread(void* arg);
+WebConn* web_conn_open(int sock, int gateway);
+void web_conn_close(WebConn* web);
+void web_conn_hold(WebConn* web);
+void web_conn_release(WebConn* web);
+int web_write_all(int sock, const char* data, size_t len);
+void web_reply(WebConn* web, const char* tag, const char* msg);
+Subscriber* bus_subscribe(int sock, pthread_mutex_t* write_lock, unsigned int kinds, const char* room_number, int policy);
+Subscriber* bus_subscribe_request(int sock, const char* request);
+void bus_unsubscribe(Subscriber* sub);
+void bus_pause(void);
+void bus_resume(void);
+void bus_publish(int kind, const char* room_number, const char* value);
+void* bus_writer_thread(void* arg);
+int sha256_hex(const void* data, size_t len, char* hex_out);
+RoomState* room_state_get(const char* room_number, MYSQL* conn);
+void room_state_on_event(int kind, const char* room_number, const char* value);
+void room_state_set_door(const char* room_number, const char* door);
+int room_state_set_password(const char* room_number, const char* pw, uint32_t* version);
+int room_state_check_password(const char* room_number, const char* pw, MYSQL* conn);
+int room_state_format(const char* room_number, MYSQL* conn, char* out, size_t out_size);
+int room_state_uid_change(const char* room_number, const char* uid, int add);
+int room_state_set_uid(const char* room_number, const char* uid, int add, uint32_t* version);
+int room_state_format_cards(const char* room_number, MYSQL* conn, char* out, size_t out_size);
+int cred_new_salt(char* out);
+int cred_salted_hash(const char* salt, const char* pw, char* hex_out);
+int cred_uid_normalize(const char* in, char* out);
+int cred_uid_index(const RoomState* st, const char* uid);
+void cred_log_add(RoomState* st, int op, const char* uid);
+int cred_sync_commands(const char* room_number, uint32_t since, char (*cmds)[CRED_CMD_LEN], int max);
+void cred_sync(const char* room_number, uint32_t since, MYSQL* conn);
+int telemetry_add(const char* room_number, const char* message);
+int telemetry_partial(const char* room_number, const char* line, int line_len);
+void telemetry_sum(const RoomState* st, long long since_minute, TelemetrySlot* sum);
+int telemetry_format_room(const char* room_number, int minutes, char* out, size_t out_size);
+int telemetry_format_worst(char* out, size_t out_size);
+AttemptSlot* attempt_slot(const char* room_number, int create);
+long long record_attempt(const char* room_number, int cred, int ok);
+long long lockout_remaining_ms(const char* room_number);
+void begin_lockout(RoomNode* node, long long lock_ms, const char* reason);
+int session_open(RoomNode* node, int seconds, const char* reason);
+void session_close(RoomNode* node, unsigned int id, const char* result);
+unsigned int session_stop(RoomNode* node, const char* reason);
+uint64_t hash64(const char* str);
+int cluster_init(int argc, char* argv[]);
+int owner_node(const char* room_number);
+int redirect_if_remote(int client_sock, const char* room_number);
+unsigned int forward_send(int node, const char* line, WebConn* web, const char* tag, const char* room_number, const char* status);
+void forward_finish(unsigned int id, const char* reply);
+char* forward_wait(unsigned int id, long long timeout_ms);
+void* peer_reader_thread(void* arg);
+int run_local_group(const char* group, const char* status, GroupResult* result);
+void merge_group_reply(GroupResult* result, const char* reply);
+void append_list(char** list, const char* item);
+ClientConn* client_register(int sock, int type, const char* hello);
+void client_unregister(ClientConn* client);
+int handoff_should_park(int client_type);
+void wake_signal(int sig);
+int park_clients(int phase);
+void drain_commands(void);
+int handoff_send_rec(int h, const char* rec, int fd);
+int handoff_recv_rec(int h, char* rec, int* fd);
+int handoff_listen(int port);
+int handoff_send(int h, int server_sock);
+int handoff_receive(int port, ClientStart** clients);
+void handoff_abort(void);
+int io_backend_by_name(const char* name);
+int io_start(int backend, int server_sock, ClientStart* resumed);
+void io_enqueue(Client* c, int kind, IoJob* job);
+IoJob* io_job_alloc(int len);
+void* io_worker_thread(void* arg);
+void* io_close_thread(void* arg);
+void io_list_add(Client* c);
+void io_list_remove(Client* c);
+void io_wake(void);
+void* io_epoll_loop(void* arg);
+void* slab_alloc(Slab* slab);
+void* slab_zalloc(Slab* slab);
+void slab_free(Slab* slab, void* obj);
+int slab_format(char* out, size_t out_size);
+int dispatch_start(void);
+int dispatch_push(DispatchTask* task);
+DispatchTask* dispatch_take(void);
+void dispatch_done(DispatchTask* task);
+void* dispatch_worker_thread(void* arg);
+void dispatch_run(DispatchTask* task, MYSQL* conn);
+void dispatch_door_done(long long start_ms);
+void dispatch_log(const char* room_number, const char* image_path, int bus_kind);
+void dispatch_upload(const char* room_number, ImageUpload* up, int bus_kind);
+int dispatch_change_password(WebConn* web, const char* tag, const char* room_number, const char* pw);
+int dispatch_card(WebConn* web, const char* tag, const char* room_number, const char* uid, int add);
+int dispatch_idle(void);
+void dispatch_drain(void);
+int dispatch_format(char* out, size_t out_size);
+int fr_failure(RoomNode* room_node, const char* room_number, long long start_ms);
+uint64_t persist_sum(const void* data, size_t len, uint64_t h);
+uint64_t wal_sum(const WalRecord* w);
+void persist_mark(const char* room_number);
+int persist_fill(const char* room_number, SnapRecord* r);
+void persist_apply(const SnapRecord* r);
+int persist_recover(int port);
+int persist_start(int port);
+int persist_snapshot(void);
+int persist_wal_append(char (*rooms)[10], int count);
+void* persist_thread(void* arg);
 
-int main() {
+int main(int argc, char* argv[]) {
+    int takeover = 0; //     Ѱܹ
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        int used = 1;
+        if (strcmp(argv[1], "--takeover") == 0) {
+            takeover = 1;
+        }
+        else if (strcmp(argv[1], "--io") == 0 && argc > 2 && io_backend_by_name(argv[2]) >= 0) {
+            io_backend = io_backend_by_name(argv[2]);
+            used = 2;
+        }
+        else {
+            argc = -1;
+            break;
+        }
+        argv[used] = argv[0];
+        argv += used;
+        argc -= used;
+    }
+    int port = argc > 1 ? atoi(argv[1]) : PORT;
+    if (argc < 0 || cluster_init(argc, argv) < 0) {
+        fprintf(stderr, "usage : %s [--takeover] [--io threads|epoll|uring] [port [self_host:port [peer_host:port ...]]]\n", argv[0]);
+        return 1;
+    }
     room_table = NULL; //   ʱȭ
     pthread_mutex_init(&room_table_mutex, NULL);
-    pthread_mutex_init(&capture_mutex, NULL);
+    pthread_mutex_init(&image_mutex, NULL);
+    pthread_mutex_init(&pending_mutex, NULL);
+    pthread_mutex_init(&web_conn_mutex, NULL);
+    pthread_cond_init(&web_idle, NULL);
+    pthread_mutex_init(&bus_mutex, NULL);
+    pthread_rwlock_init(&room_state_lock, NULL);
+    pthread_mutex_init(&forward_mutex, NULL);
+    pthread_cond_init(&forward_done, NULL);
+    pthread_mutex_init(&client_mutex, NULL);
+    pthread_cond_init(&handoff_resume, NULL);
+    pthread_mutex_init(&dispatch_mutex, NULL);
+    pthread_cond_init(&dispatch_ready, NULL);
+    pthread_mutex_init(&persist_mutex, NULL);
+    signal(SIGPIPE, SIG_IGN); //  Ͽ    ʵ( ȯ ó)
+    struct sigaction wake = { 0 };
+    wake.sa_handler = wake_signal;
+    sigaction(SIGUSR1, &wake, NULL); // SA_RESTART  :   recv  б⸦ ߰ 
     struct sockaddr_in server_addr;
+    int server_sock = -1;
+    ClientStart* resumed = NULL;
 
-    int server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock == -1) {
-        perror("server socket fail");
-        return 1;
+    if (!takeover) {
+        persist_recover(port); // ũ   (/FR ٽ ϱ   ȸ )
+    }
+    if (takeover) {
+        server_sock = handoff_receive(port, &resumed);
+        if (server_sock < 0) {
+            fprintf(stderr, "takeover fail\n");
+            return 1;
+        }
     }
+    else {
+        server_sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_sock == -1) {
+            perror("server socket fail");
+            return 1;
+        }
+        int reuse = 1;
+        setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)); //   TIME_WAIT  bind  ʵ
 
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    server_addr.sin_port = htons(PORT);
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        server_addr.sin_port = htons(port);
 
-    if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-        perror("bind fail");
-        close(server_sock);
-        return 1;
+        if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+            perror("bind fail");
+            close(server_sock);
+            return 1;
+        }
+
+        //  ѱ   ᵵ ⿭ ٸ ˳ϰ
+        if (listen(server_sock, SOMAXCONN) == -1) {
+            perror("listen fail");
+            close(server_sock);
+            return 1;
+        }
+    }
+    int handoff_sock = handoff_listen(port);
+    persist_start(port);
+
+    printf("server start. client wait...\n");
+    if (cluster_count > 1) {
+        printf("cluster node %s (%d nodes).\n", cluster_nodes[self_node].addr, cluster_count);
     }
 
-    if (listen(server_sock, 5) == -1) {
-        perror("listen fail");
-        close(server_sock);
+    // ̹ /йȣ  ť ó 
+    if (dispatch_start() < 0) {
         return 1;
     }
 
-    printf("server start. client wait...\n");
+    //   ESP  ð ʰ ó 
+    pthread_t timeout_tid;
+    pthread_create(&timeout_tid, NULL, command_timeout_thread, NULL);
+
+    if (io_backend != IO_BACKEND_THREADS) {
+        // ̺Ʈ  : accept б I/O ,    û ٸ
+        io_backend = io_start(io_backend, server_sock, resumed);
+        if (io_backend < 0) {
+            return 1;
+        }
+        printf("io : %s.\n", io_backend == IO_BACKEND_URING ? "io_uring" : "epoll");
+    }
+    else {
+        // Ѱܹ  λ縻 ó ٽ 
+        while (resumed) {
+            ClientStart* start = resumed;
+            resumed = start->next;
+            pthread_t tid;
+            pthread_create(&tid, NULL, client_handler, start);
+        }
+    }
 
+    struct pollfd fds[2] = { { io_backend == IO_BACKEND_THREADS ? server_sock : -1, POLLIN, 0 }, { handoff_sock, POLLIN, 0 } };
     while (1) {
-        int* client_sock = malloc(sizeof(int));
-        *client_sock = accept(server_sock, NULL, NULL);
-        if (*client_sock < 0) {
+        if (poll(fds, handoff_sock >= 0 ? 2 : 1, -1) < 0) {
+            if (errno != EINTR) perror("poll fail");
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            //    Ѱܹ  : ѱ  accept  (    )
+            int h = accept(handoff_sock, NULL, NULL);
+            if (h >= 0) {
+                int result = handoff_send(h, server_sock);
+                close(h);
+                if (result == 0) {
+                    printf("handoff done. exit.\n");
+                    exit(0);
+                }
+                if (result < 0) {
+                    //   ׾ų ߸  : ѱ    ʰ    ó
+                    printf("handoff fail. resume.\n");
+                    handoff_abort();
+                }
+            }
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        ClientStart* start = (ClientStart*)slab_alloc(&client_start_slab);
+        start->hello[0] = '\0';
+        start->next = NULL;
+        start->sock = accept(server_sock, NULL, NULL);
+        if (start->sock < 0) {
             perror("accept fail");
-            free(client_sock);
+            slab_free(&client_start_slab, start);
             continue;
         }
 
         pthread_t tid;
-        pthread_create(&tid, NULL, client_handler, client_sock);
+        pthread_create(&tid, NULL, client_handler, start);
     }
 
     close(server_sock);
-    pthread_mutex_destroy(&capture_mutex);
+    pthread_mutex_destroy(&image_mutex);
+    pthread_mutex_destroy(&pending_mutex);
+    pthread_mutex_destroy(&web_conn_mutex);
+    pthread_cond_destroy(&web_idle);
+    pthread_mutex_destroy(&bus_mutex);
+    pthread_rwlock_destroy(&room_state_lock);
+    pthread_mutex_destroy(&forward_mutex);
+    pthread_cond_destroy(&forward_done);
+    pthread_cond_destroy(&handoff_resume);
+    pthread_mutex_destroy(&client_mutex);
     pthread_mutex_destroy(&room_table_mutex);
     return 0;
 }
 
 // ο  带 ϴ Լ
 RoomNode* create_room_node(const char* room_number) {
-    RoomNode* new_node = (RoomNode*)malloc(sizeof(RoomNode));
+    RoomNode* new_node = (RoomNode*)slab_alloc(&room_slab); //  ʵ带 Ʒ ä
     strcpy(new_node->room_number, room_number);
     new_node->esp_sock = -1;
     new_node->fr_sock = -1;
+    pthread_mutex_init(&new_node->lock, NULL);
+    new_node->event_tokens = EVENT_BUCKET_SIZE;
+    new_node->token_refill_ms = now_ms();
+    memset(new_node->last_event_ms, 0, sizeof(new_node->last_event_ms));
+    new_node->dropped_events = 0;
+    new_node->cmd_rtt_last_ms = 0;
+    new_node->cmd_rtt_avg_ms = 0;
+    new_node->cmd_rtt_max_ms = 0;
+    new_node->cmd_acked = 0;
+    new_node->cmd_nacked = 0;
+    new_node->cmd_timeouts = 0;
+    new_node->session_id = 0;
+    new_node->session_start_ms = 0;
+    new_node->session_until_ms = 0;
+    new_node->session_sent_until_ms = 0;
+    new_node->sessions = 0;
+    new_node->refs = 0;
+    new_node->unlinked = 0;
     new_node->next = NULL;
     return new_node;
 }
 
-//  ȣ  带 ã Լ
+//  ȣ  带 ã Լ :  ڿ   Ƿ 带  room_node_hold(    )
 RoomNode* find_room_node(const char* room_number) {
     pthread_mutex_lock(&room_table_mutex); //   ؽ 
     RoomNode* current = room_table;
@@ -126,213 +1037,673 @@ void add_room_node(RoomNode* new_node) {
     pthread_mutex_unlock(&room_table_mutex); //  
 }
 
-//  带 ϰ ޸ 
-void delete_room_node(const char* room_number) {
-    pthread_mutex_lock(&room_table_mutex); //   ؽ 
-    RoomNode* current = room_table;
-    RoomNode* prev = NULL;
+//  ȣ  1~9ڸ : /ESP/FR   ȣ SQL  ״ Ƿ ޴   Ȯ
+int room_number_valid(const char* room_number) {
+    size_t len = strspn(room_number, "0123456789");
+    return len > 0 && len < 10 && room_number[len] == '\0';
+}
 
-    while (current != NULL) {
-        if (strcmp(current->room_number, room_number) == 0) {
-            if (prev != NULL) {
-                prev->next = current->next;
-            }
-            else {
-                room_table = current->next; // ù °  
-            }
-            free(current); // ޸ 
-            break;
+//     (<>,<>...) :  ϳ ̻̰  room_number_valid
+int room_list_valid(const char* list) {
+    char room_number[10];
+    do {
+        size_t len = strcspn(list, ",");
+        if (len == 0 || len >= sizeof(room_number)) {
+            return 0;
+        }
+        memcpy(room_number, list, len);
+        room_number[len] = '\0';
+        if (!room_number_valid(room_number)) {
+            return 0;
+        }
+        list += len;
+    } while (*list++ == ',');
+    return 1;
+}
+
+// ESP/FR   忡  : ã/     ؽ ȿ   
+//      room_detach    
+RoomNode* room_attach(const char* room_number, int client_type, int client_sock) {
+    pthread_mutex_lock(&room_table_mutex);
+    RoomNode* node = room_table;
+    while (node != NULL && strcmp(node->room_number, room_number) != 0) {
+        node = node->next;
+    }
+    if (!node) {
+        node = create_room_node(room_number);
+        node->next = room_table;
+        room_table = node;
+    }
+    node->refs++;
+    pthread_mutex_lock(&node->lock);
+    int* slot = (client_type == CLIENT_TYPE_ESP) ? &node->esp_sock : &node->fr_sock;
+    if (*slot != -1) {
+        shutdown(*slot, SHUT_RDWR); //   (   ó ʿ )
+    }
+    *slot = client_sock;
+    pthread_mutex_unlock(&node->lock);
+    pthread_mutex_unlock(&room_table_mutex);
+    return node;
+}
+
+//   ESP/FR   忡 , ESP FR    Ͽ 
+//  Ȯΰ Ͽ ⸦   ؽ +   ȿ ϹǷ     ص    
+//  ̸ ƴ϶    ͷ ã( ݱ ̶ ȣ ٸ ῡ  )
+void room_detach(RoomNode* node, int client_type, int client_sock) {
+    pthread_mutex_lock(&room_table_mutex);
+    pthread_mutex_lock(&node->lock);
+    int* slot = (client_type == CLIENT_TYPE_ESP) ? &node->esp_sock : &node->fr_sock;
+    if (*slot == client_sock) {
+        *slot = -1; //   ٲ ״
+    }
+    int idle = (node->esp_sock == -1) && (node->fr_sock == -1);
+    pthread_mutex_unlock(&node->lock);
+    if (idle && !node->unlinked) {
+        RoomNode** pp = &room_table;
+        while (*pp != NULL && *pp != node) {
+            pp = &(*pp)->next;
+        }
+        if (*pp == node) {
+            *pp = node->next;
         }
-        prev = current;
+        node->unlinked = 1;
+    }
+    if (--node->refs == 0 && node->unlinked) {
+        room_node_free(node);
+    }
+    pthread_mutex_unlock(&room_table_mutex);
+}
+
+//  ȣ  带 ãƼ   : room_node_release  ٸ 尡   
+RoomNode* room_node_hold(const char* room_number) {
+    pthread_mutex_lock(&room_table_mutex);
+    RoomNode* current = room_table;
+    while (current != NULL && strcmp(current->room_number, room_number) != 0) {
         current = current->next;
     }
-    pthread_mutex_unlock(&room_table_mutex); //  
+    if (current) current->refs++;
+    pthread_mutex_unlock(&room_table_mutex);
+    return current;
+}
+
+void room_node_release(RoomNode* node) {
+    if (!node) return;
+    pthread_mutex_lock(&room_table_mutex);
+    if (--node->refs == 0 && node->unlinked) {
+        room_node_free(node);
+    }
+    pthread_mutex_unlock(&room_table_mutex);
+}
+
+// Ͽ      (room_table_mutex  ¿ ȣ)
+void room_node_free(RoomNode* node) {
+    pthread_mutex_destroy(&node->lock);
+    slab_free(&room_slab, node); // ޸ (  尡 )
 }
 
-void handle_web_message(int client_sock, char* message, MYSQL* conn) {
+void handle_web_message(WebConn* web, char* message, MYSQL* conn) {
     //  ó
-    char room_number[BUF_SIZE] = { 0 };
-    char status[BUF_SIZE] = { 0 };
-    char pw[BUF_SIZE] = { 0 };
+    long long start_ms = now_ms(); //   ó ð(PRIO_DOOR  )
+    char tag[WEB_TAG_LEN] = { 0 };
+    if (message[0] == '@') {
+        // ±  û, 信  ±׸ ٿ 
+        size_t tag_len = strcspn(message + 1, " ");
+        if (tag_len >= sizeof(tag) || message[1 + tag_len] != ' ') {
+            //  ٸ Ʈ̰  ʵ ˾ƺ  ִ ŭ ±׸ ٿ  
+            printf("WEB : bad request tag.\n");
+            memcpy(tag, message + 1, tag_len < sizeof(tag) ? tag_len : sizeof(tag) - 1);
+            web_reply(web, tag, "WEB:error:bad_request\n");
+            return;
+        }
+        memcpy(tag, message + 1, tag_len);
+        message += tag_len + 2;
+    }
+
+    if (strcmp(message, "WEB:ping") == 0) {
+        web_reply(web, tag, "WEB:pong\n");
+        return;
+    }
+    if (strcmp(message, "WEB:alloc") == 0) {
+        // ü Ǯ 뷮 : WEB:alloc:≮>=< >/<ִ>/<Ҵ >/< >/<ûũ >:...
+        char stats[BUF_SIZE * 2];
+        char reply[BUF_SIZE * 3];
+        slab_format(stats, sizeof(stats));
+        snprintf(reply, sizeof(reply), "WEB:alloc:%s\n", stats);
+        web_reply(web, tag, reply);
+        return;
+    }
+    if (strcmp(message, "WEB:dispatch") == 0) {
+        // 켱 Ŭ : WEB:dispatch:<Ŭ>=<>/<ó>/< ʰ>/<ִ ms>/<>:...
+        char stats[BUF_SIZE];
+        char reply[BUF_SIZE * 2];
+        dispatch_format(stats, sizeof(stats));
+        snprintf(reply, sizeof(reply), "WEB:dispatch:%s\n", stats);
+        web_reply(web, tag, reply);
+        return;
+    }
+    if (strcmp(message, "WEB:telemetry") == 0) {
+        // ֱ 1ð    : WEB:telemetry:<>=<RSSI >/<>/< >/< պ  ms>:...
+        char stats[BUF_SIZE * 2];
+        char reply[BUF_SIZE * 3];
+        telemetry_format_worst(stats, sizeof(stats));
+        snprintf(reply, sizeof(reply), "WEB:telemetry:%s\n", stats);
+        web_reply(web, tag, reply);
+        return;
+    }
+    if (strncmp(message, "WEB:room_", 9) != 0) {
+        // /ǹ/   ,    ٸǷ 忡 ó  û  
+        GroupRequest* req = (GroupRequest*)calloc(1, sizeof(GroupRequest));
+        if (!req) {
+            web_reply(web, tag, "WEB:error:no_memory\n");
+            return;
+        }
+        if (sscanf(message, "WEB:%255[^:]:%255[^:]", req->group, req->status) != 2 ||
+            (strncmp(req->group, "rooms_", 6) == 0 && !room_list_valid(req->group + 6))) {
+            //  ϵ   û    ȣ(߸  ϳ  û ü )
+            printf("WEB : bad request %s.\n", message);
+            web_reply(web, tag, "WEB:error:bad_request\n");
+            free(req);
+            return;
+        }
+        strcpy(req->tag, tag);
+        req->web = web;
+        web_conn_hold(web);
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, group_request_thread, req) != 0) {
+            group_request_thread(req);
+        }
+        else {
+            pthread_detach(tid);
+        }
+        return;
+    }
+
+    char room_number[BUF_SIZE];
+    char status[BUF_SIZE];
+    char pw[BUF_SIZE];
+    room_number[0] = status[0] = pw[0] = '\0'; // ޽  ü 0 ä (sscanf  κ  )
     sscanf(message, "WEB:room_%[^:]:%[^:]:%[^:]", room_number, status, pw);
-    RoomNode* room_node = find_room_node(room_number);
+    if (!room_number_valid(room_number)) {
+        printf("WEB : bad room number.\n");
+        web_reply(web, tag, "WEB:error:bad_request\n");
+        return;
+    }
+    if (!web->peer && strlen(room_number) < 10 && owner_node(room_number) != self_node) {
+        // ٸ    :   忡  forward_finish 
+        int owner = owner_node(room_number);
+        forward_send(owner, message, web, tag, room_number, status);
+        return;
+    }
 
+    char reply[BUF_SIZE * 4]; // ī  
+    //  ĳ÷ óϴ û  Ǿ  ʾƵ 
+    if (strcmp(status, "status") == 0) {
+        char state[BUF_SIZE];
+        if (room_state_format(room_number, conn, state, sizeof(state)) < 0) {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:status:error\n", room_number);
+        }
+        else {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:status:%s\n", room_number, state);
+        }
+        web_reply(web, tag, reply);
+        return;
+    }
+    if (strcmp(status, "login") == 0) {
+        int ok = room_state_check_password(room_number, pw, conn);
+        snprintf(reply, sizeof(reply), "WEB:room_%s:login:%s\n", room_number, ok ? "ok" : "fail");
+        web_reply(web, tag, reply);
+        return;
+    }
+    if (strcmp(status, "change_PW") == 0) {
+        // DB  ó 忡(  ), 䵵 ó 尡 
+        if (dispatch_change_password(web, tag, room_number, pw) < 0) {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:change_PW:fail\n", room_number);
+            web_reply(web, tag, reply);
+        }
+        return;
+    }
+    if (strcmp(status, "cards") == 0) {
+        // ī  : WEB:room_X:cards:ver=<>:uids=<UID,UID,...|->
+        char cards[CRED_MAX_UIDS * (CRED_UID_LEN + 1) + 32];
+        if (room_state_format_cards(room_number, conn, cards, sizeof(cards)) < 0) {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:cards:error\n", room_number);
+        }
+        else {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:cards:%s\n", room_number, cards);
+        }
+        web_reply(web, tag, reply);
+        return;
+    }
+    if (strcmp(status, "telemetry") == 0) {
+        // ESP   : WEB:room_X:telemetry[:<ֱ  , ⺻ 60>]
+        char stats[BUF_SIZE * 8];
+        char telemetry_reply[BUF_SIZE * 10];
+        int minutes = pw[0] ? atoi(pw) : TELEMETRY_SLOTS;
+        if (telemetry_format_room(room_number, minutes, stats, sizeof(stats)) < 0) {
+            snprintf(telemetry_reply, sizeof(telemetry_reply), "WEB:room_%s:telemetry:none\n", room_number);
+        }
+        else {
+            snprintf(telemetry_reply, sizeof(telemetry_reply), "WEB:room_%s:telemetry:%s\n", room_number, stats);
+        }
+        web_reply(web, tag, telemetry_reply);
+        return;
+    }
+    if (strcmp(status, "add_uid") == 0 || strcmp(status, "del_uid") == 0) {
+        // ī ߰/(WEB:room_X:add_uid:<UID 16>), change_PW  ó 尡 DB  
+        char uid[CRED_UID_LEN + 1];
+        int add = strcmp(status, "add_uid") == 0;
+        if (cred_uid_normalize(pw, uid) < 0 || dispatch_card(web, tag, room_number, uid, add) < 0) {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:%s:fail\n", room_number, status);
+            web_reply(web, tag, reply);
+        }
+        return;
+    }
+    //  ó     ưǷ óϴ  带  (  ESP/FR ܵ  )
+    RoomNode* room_node = room_node_hold(room_number);
     if (!room_node) {
         printf("Not found room %s.\n", room_number);
+        snprintf(reply, sizeof(reply), "WEB:room_%s:%s:offline\n", room_number, status);
+        web_reply(web, tag, reply);
         return;
     }
     //    ȣ ó
     if (strcmp(status, "open") == 0) {
         printf("WEB : room %s opened sign.\n", room_number);
-        int esp_sock = room_node->esp_sock;
-        if (esp_sock > 0) {
-            char open_msg[BUF_SIZE];
-            snprintf(open_msg, sizeof(open_msg), "open\n");
-            write(esp_sock, open_msg, strlen(open_msg));
+        // (ack/nack/timeout) ESP   resolve_command  
+        if (send_room_command(room_node, "open", web, tag, NULL, NULL) == 0) {
+            printf("Not found room %s.\n", room_number);
+            snprintf(reply, sizeof(reply), "WEB:room_%s:open:offline\n", room_number);
+            web_reply(web, tag, reply);
         }
         else {
-            printf("Not found room %s.\n", room_number);
+            dispatch_door_done(start_ms);
+        }
+    }
+    else if (strcmp(status, "session") == 0) {
+        // ν  ( ̸ ) : WEB:room_X:session:<id>:<> | fr_offline | locked
+        int seconds = pw[0] ? atoi(pw) : SESSION_SECONDS;
+        int id = session_open(room_node, seconds, "web");
+        if (id > 0) {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:session:%d:%d\n", room_number, id, seconds);
+        }
+        else {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:session:%s\n", room_number, id == 0 ? "fr_offline" : "locked");
+        }
+        web_reply(web, tag, reply);
+    }
+    else if (strcmp(status, "session_stop") == 0) {
+        unsigned int id = session_stop(room_node, "web");
+        if (id > 0) {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:session_stop:%u\n", room_number, id);
         }
+        else {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:session_stop:none\n", room_number);
+        }
+        web_reply(web, tag, reply);
     }
-    else if (strcmp(status, "change_PW") == 0) {
-        change_password(conn, pw, room_number);
+    else if (strcmp(status, "latency") == 0) {
+        // 溰  պ ð ȸ
+        pthread_mutex_lock(&room_node->lock);
+        snprintf(reply, sizeof(reply), "WEB:room_%s:latency:last=%lld:avg=%.0f:max=%lld:ack=%u:nack=%u:timeout=%u\n",
+            room_number, room_node->cmd_rtt_last_ms, room_node->cmd_rtt_avg_ms, room_node->cmd_rtt_max_ms,
+            room_node->cmd_acked, room_node->cmd_nacked, room_node->cmd_timeouts);
+        pthread_mutex_unlock(&room_node->lock);
+        web_reply(web, tag, reply);
     }
+    room_node_release(room_node);
 }
 
 // ޽ óϴ Լ
 void handle_message(const char* room_number, int client_sock, char* message, MYSQL* conn, int client_type) {
-    RoomNode* room_node = find_room_node(room_number);
+    long long start_ms = now_ms(); //   ó ð(PRIO_DOOR  )
+    // ̸ ã        Ƿ       
+    RoomNode* room_node = room_node_hold(room_number);
     if (!room_node) {
         printf("Not found room %s.\n", room_number);
         return;
     }
 
     if (client_type == CLIENT_TYPE_ESP) {  // ESP32 ó
-        char status[BUF_SIZE] = { 0 };
-        sscanf(message, "ESP32:room_%*[^:]:%[^:]", status);
-
-        if (strcmp(status, "wrong_password") == 0) {
-            printf("ESP32: room %s fail password. FR capture request...\n", room_number);
-            int fr_sock = room_node->fr_sock;
-            if (fr_sock > 0) {
-                pthread_mutex_lock(&capture_mutex); //  û 
-                char capture_request_msg[BUF_SIZE];
-                snprintf(capture_request_msg, sizeof(capture_request_msg), "FR:room_%s:request_capture", room_number);
-                write(fr_sock, capture_request_msg, strlen(capture_request_msg));
-                pthread_mutex_unlock(&capture_mutex);
+        char status[BUF_SIZE];
+        unsigned int command_id = 0;
+        char reason[BUF_SIZE];
+        status[0] = reason[0] = '\0';
+        sscanf(message, "ESP32:room_%*[^:]:%[^:]:%u:%[^:]", status, &command_id, reason);
+
+        if (strcmp(status, "ack") == 0) {
+            resolve_command(command_id, room_number, CMD_ACK, NULL);
+        }
+        else if (strcmp(status, "nack") == 0) {
+            resolve_command(command_id, room_number, CMD_NACK, reason);
+        }
+        else if (strcmp(status, "auth_fail") == 0 || strcmp(status, "auth_ok") == 0) {
+            // õ ,  δ  
+            char cred_str[16] = { 0 };
+            sscanf(message, "ESP32:room_%*[^:]:%*[^:]:%15s", cred_str);
+            int cred = strcmp(cred_str, "rfid") == 0 ? CRED_RFID : CRED_KEYPAD;
+            long long lock_ms = record_attempt(room_number, cred, strcmp(status, "auth_ok") == 0);
+            if (lock_ms > 0) {
+                begin_lockout(room_node, lock_ms, cred_name[cred]);
             }
-            else {
-                printf("Not found room %s.\n", room_number);
+        }
+        else if (strcmp(status, "wrong_password") == 0) {
+            //  ߿(⿡ 5ȸ и  )
+            begin_lockout(room_node, LOCKOUT_MS, "keypad");
+        }
+        else if (strcmp(status, "sync") == 0) {
+            //  , Ǵ  ̾ ʴ  ޾  : ESP32:room_X:sync:< >
+            cred_sync(room_number, command_id, conn);
+        }
+        else if (strcmp(status, "telemetry") == 0) {
+            if (telemetry_add(room_number, message) < 0) {
+                printf("room %s bad telemetry record.\n", room_number);
             }
         }
+        else if (strcmp(status, "session") == 0) {
+            //  տ  ( Űе ġ ) : FR ν  
+            char why[16] = { 0 };
+            sscanf(message, "ESP32:room_%*[^:]:%*[^:]:%15s", why);
+            session_open(room_node, SESSION_SECONDS, why[0] ? why : "esp");
+        }
     }
     else if (client_type == CLIENT_TYPE_FR) {  // FR ó
-        char status[BUF_SIZE] = { 0 };
-        char image_path[BUF_SIZE] = { 0 };
+        char status[BUF_SIZE];
+        char image_path[BUF_SIZE];
+        status[0] = image_path[0] = '\0';
         sscanf(message, "FR:room_%*[^:]:%[^:]:%s", status, image_path);
 
         if (strcmp(status, "failure") == 0) {
-            printf("FR: room %s fail face recognition. to ESP32 send signal...\n", room_number);
-            // ESP32  ȣ 
-            int esp_sock = room_node->esp_sock;
-            if (esp_sock > 0) {
-                char failure_msg[BUF_SIZE];
-                snprintf(failure_msg, sizeof(failure_msg), "failure\n");
-                write(esp_sock, failure_msg, strlen(failure_msg));
-                save_image_path(conn, image_path, room_number);
-            }
-            else {
-                printf("Not found room %s.\n", room_number);
+            // ESP32  ȣ ٷ, DB ϰ ̺Ʈ ó 忡
+            if (fr_failure(room_node, room_number, start_ms)) {
+                dispatch_log(room_number, image_path, BUS_INTRUDER);
             }
         }
         else if (strcmp(status, "success") == 0) {
-            int esp_sock = room_node->esp_sock;
-            if (esp_sock > 0) {
-                char activate_keypad_msg[BUF_SIZE];
-                snprintf(activate_keypad_msg, sizeof(activate_keypad_msg), "activate_keypad\n");
-                write(esp_sock, activate_keypad_msg, strlen(activate_keypad_msg));
+            if (lockout_remaining_ms(room_number) > 0) {
+                //  ߿ ν ص Űе带  
+                printf("FR: room %s success ignored, locked out.\n", room_number);
             }
             else {
-                printf("Not found room %s.\n", room_number);
+                record_attempt(room_number, CRED_FACE, 1);
+                if (send_room_command(room_node, "activate_keypad", NULL, NULL, NULL, NULL) == 0) {
+                    printf("Not found room %s.\n", room_number);
+                }
+                else {
+                    dispatch_door_done(start_ms);
+                }
             }
         }
         else if (strcmp(status, "capture") == 0) {
-            save_image_path(conn, image_path, room_number);
+            if (allow_room_event(room_node, EVENT_CAPTURE)) {
+                dispatch_log(room_number, image_path, BUS_CAPTURED);
+            }
+        }
+        else if (strcmp(status, "session_end") == 0) {
+            unsigned int id = 0;
+            char result[16] = { 0 };
+            sscanf(message, "FR:room_%*[^:]:%*[^:]:%u:%15s", &id, result);
+            session_close(room_node, id, result);
         }
     }
-
+    room_node_release(room_node);
 }
 
 // Ŭ̾Ʈ ڵ鷯 Լ
 void* client_handler(void* arg) {
-    int client_sock = *(int*)arg;
-    free(arg);
+    ClientStart* start = (ClientStart*)arg;
+    int resumed = start->hello[0] != '\0'; //   Ѱܹ 
 
     MYSQL* conn = mysql_init(NULL);
     if (!mysql_real_connect(conn, server, user, password, database, 0, NULL, 0)) {
         fprintf(stderr, "DB connect error : %s\n", mysql_error(conn));
-        close(client_sock);
+        close(start->sock);
+        slab_free(&client_start_slab, start);
         return NULL;
     }
 
-    char buffer[BUF_SIZE];
-    char room_number[10] = { 0 };
-    int client_type = 0;
+    char buffer[RECV_BUF_SIZE]; //   ,   ڿ '\0' 
+    Client* c = (Client*)slab_zalloc(&client_slab);
+    c->sock = start->sock;
 
     // Ŭ̾Ʈ   ȣ ľ
-    recv(client_sock, buffer, sizeof(buffer), 0);
-    if (sscanf(buffer, "ESP32:room_%s", room_number) == 1) {
-        client_type = CLIENT_TYPE_ESP;
-        RoomNode* room_node = find_room_node(room_number);
-        if (!room_node) {
-            room_node = create_room_node(room_number);
-            add_room_node(room_node);
-        }
-        else if (room_node->esp_sock != -1) {
-            close(room_node->esp_sock); //    
-        }
-        room_node->esp_sock = client_sock;
-        printf("ESP32 room %s connect.\n", room_number);
+    int hello_len;
+    if (resumed) {
+        strcpy(buffer, start->hello);
+        hello_len = strlen(buffer);
     }
-    else if (sscanf(buffer, "FR:room_%s", room_number) == 1) {
-        client_type = CLIENT_TYPE_FR;
-        RoomNode* room_node = find_room_node(room_number);
-        if (!room_node) {
-            room_node = create_room_node(room_number);
-            add_room_node(room_node);
-        }
-        else if (room_node->fr_sock != -1) {
-            close(room_node->fr_sock); //    
-        }
-        room_node->fr_sock = client_sock;
-        printf("FR room %s connect.\n", room_number);
+    else {
+        hello_len = recv(c->sock, buffer, BUF_SIZE - 1, 0);
     }
-    else if (strncmp(buffer,"WEB",3) == 0) {
-        client_type = CLIENT_TYPE_WEB;
-        printf("WEB connect.\n");
+    slab_free(&client_start_slab, start);
+    int offset = client_hello(c, buffer, hello_len, conn, resumed);
+    if (offset < 0) {
+        close(c->sock);
+        slab_free(&client_slab, c);
+        mysql_close(conn);
+        return NULL;
+    }
+    // λ縻   û(̴)
+    if (offset < hello_len) {
+        client_feed(c, buffer + offset, hello_len - offset, conn);
     }
 
     // ޽ ó 
     while (1) {
-        memset(buffer, 0, BUF_SIZE);
-        int bytes_received = recv(client_sock, buffer, sizeof(buffer) - 1, 0);
+        if (handoff_should_park(c->type) && client_idle(c)) {
+            //   :   ʰ(/   ״)   ѱ,   ʹ   
+            // ѱ  μ , ѱ⿡ ϸ handoff_abort  ٽ 
+            pthread_mutex_lock(&client_mutex);
+            if (handoff_should_park(c->type)) {
+                c->self->parked = 1;
+                while (c->self->parked) {
+                    pthread_cond_wait(&handoff_resume, &client_mutex);
+                }
+            }
+            pthread_mutex_unlock(&client_mutex);
+            continue;
+        }
+        int bytes_received = recv(c->sock, buffer, sizeof(buffer) - 1, 0);
+        if (bytes_received < 0 && errno == EINTR) {
+            continue; //  ȣ 
+        }
         if (bytes_received <= 0) {
             printf("client close.\n");
             break; // Ŭ̾Ʈ     
         }
-        buffer[bytes_received] = '\0'; // ڿ 
+        client_feed(c, buffer, bytes_received, conn);
+    }
+    client_finish(c);
+    mysql_close(conn); // DB  
+    return NULL;
+}
+
+// λ縻 ó : Ŭ̾Ʈ   ȣ ϰ , λ縻   ġ ȯ(  ϸ -1)
+// buffer len + 1 Ʈ ̻
+int client_hello(Client* c, char* buffer, int len, MYSQL* conn, int resumed) {
+    int client_sock = c->sock;
+    char* room_number = c->room_number;
+    c->hello_done = 1;
+    if (len <= 0) {
+        return -1;
+    }
+    buffer[len] = '\0';
+    int offset = len;
+    char* hello_end = memchr(buffer, '\n', len);
+    if (hello_end) {
+        offset = (int)(hello_end + 1 - buffer);
+        *hello_end = '\0';
+    }
+    if (sscanf(buffer, "ESP32:room_%9s", room_number) == 1) {
+        if (!room_number_valid(room_number)) {
+            printf("ESP32 bad room number %s.\n", room_number);
+            return -1;
+        }
+        if (redirect_if_remote(client_sock, room_number)) {
+            return -1;
+        }
+        c->type = CLIENT_TYPE_ESP;
+        c->node = room_attach(room_number, CLIENT_TYPE_ESP, client_sock);
+        printf("ESP32 room %s %s.\n", room_number, resumed ? "resume" : "connect");
+        if (!resumed) {
+            bus_publish(BUS_CONNECTED, room_number, "esp"); //   ESP sync   ˸ 
+        }
+    }
+    else if (sscanf(buffer, "FR:room_%9s", room_number) == 1) {
+        if (!room_number_valid(room_number)) {
+            printf("FR bad room number %s.\n", room_number);
+            return -1;
+        }
+        if (redirect_if_remote(client_sock, room_number)) {
+            return -1;
+        }
+        c->type = CLIENT_TYPE_FR;
+        c->node = room_attach(room_number, CLIENT_TYPE_FR, client_sock);
+        if (!resumed) {
+            pthread_mutex_lock(&c->node->lock);
+            c->node->session_id = 0; //  FR μ  · 
+            pthread_mutex_unlock(&c->node->lock);
+        }
+        printf("FR room %s %s.\n", room_number, resumed ? "resume" : "connect");
+        if (!resumed) {
+            bus_publish(BUS_CONNECTED, room_number, "fr");
+        }
+    }
+    else if (strncmp(buffer,"WEB",3) == 0) {
+        c->type = CLIENT_TYPE_WEB;
+        c->web = web_conn_open(client_sock, strncmp(buffer, "WEB:gateway", 11) == 0);
+        c->web->peer = strncmp(buffer, "WEB:peer", 8) == 0;
+        printf("WEB %sconnect.\n", c->web->gateway ? "gateway " : c->web->peer ? "peer " : "");
+    }
+    else if (strncmp(buffer, "SUB", 3) == 0) {
+        c->type = CLIENT_TYPE_SUB;
+        c->sub = bus_subscribe_request(client_sock, buffer);
+        printf("SUB connect.\n");
+    }
+    if (c->type != 0) {
+        c->self = client_register(client_sock, c->type, buffer);
+    }
+    return offset;
+}
+
+//   ó :   recv  ޽(ٹٲ ) ̹ Ͱ    
+// buffer len + 1 Ʈ ̻
+void client_feed(Client* c, char* buffer, int bytes_received, MYSQL* conn) {
+    int client_sock = c->sock;
+    int client_type = c->type;
+    const char* room_number = c->room_number;
+    ImageUpload* upload = &c->upload;
+    char* header = c->header; //   recv   ̹ /Ʈ û
+    buffer[bytes_received] = '\0'; // ڿ 
+
+    int offset = 0;
+    while (offset < bytes_received) {
+        if (upload->active) {
+            offset += feed_image_upload(upload, buffer + offset, bytes_received - offset);
+            if (upload->error) {
+                printf("FR: room %s image frame error.\n", room_number);
+                end_image_upload(upload);
+            }
+            else if (upload->done) {
+                // failure ESP  ȣ  , ̹  DB  ó 忡(̺Ʈ ѿ ɸ  )
+                RoomNode* room_node = room_node_hold(room_number);
+                int failure = strcmp(upload->status, "failure") == 0;
+                int log = 0;
+                if (!upload->discard && room_node) {
+                    if (failure) log = fr_failure(room_node, room_number, now_ms());
+                    else if (strcmp(upload->status, "capture") == 0) log = allow_room_event(room_node, EVENT_CAPTURE);
+                }
+                room_node_release(room_node);
+                if (log) {
+                    dispatch_upload(room_number, upload, failure ? BUS_INTRUDER : BUS_CAPTURED);
+                }
+                end_image_upload(upload);
+            }
+            continue;
+        }
+
+        char* line = buffer + offset;
+        char* newline = memchr(line, '\n', bytes_received - offset);
+        int line_len = newline ? (int)(newline - line) : bytes_received - offset;
+        line[line_len] = '\0';
+        offset += line_len + (newline ? 1 : 0);
+        if (line_len > 0 && line[line_len - 1] == '\r') line[--line_len] = '\0';
+
+        if (header[0] != '\0') {
+            //  recv ߸  ̾ ̱
+            strncat(header, line, sizeof(c->header) - strlen(header) - 1);
+            if (!newline) continue;
+            line = header;
+        }
+        else if (!newline && ((client_type == CLIENT_TYPE_FR && strstr(line, ":image:")) || (client_type == CLIENT_TYPE_WEB && c->web->gateway) ||
+            (client_type == CLIENT_TYPE_ESP && telemetry_partial(room_number, line, line_len)))) {
+            // Ʈ û ESP     ޾ Ƿ recv 迡 ߸   Ϳ ħ
+            strncpy(header, line, sizeof(c->header) - 1);
+            continue;
+        }
+
+        if (client_type == CLIENT_TYPE_FR && begin_image_upload(upload, line)) {
+            header[0] = '\0';
+            continue;
+        }
+        if (line[0] == '\0') continue;
+
         if (client_type == CLIENT_TYPE_WEB) {
-            handle_web_message(client_sock, buffer, conn);
+            handle_web_message(c->web, line, conn);
+        }
+        else if (client_type == CLIENT_TYPE_SUB) {
+            continue; //   ޱ⸸ 
         }
         else {
-            handle_message(room_number, client_sock, buffer, conn, client_type);
+            handle_message(room_number, client_sock, line, conn, client_type);
         }
-
+        header[0] = '\0';
     }
+}
+
+// ޽ (̹   ƴ),    ¿ ѱ
+int client_idle(Client* c) {
+    return !c->upload.active && c->header[0] == '\0';
+}
+
+//    : Ŭ̾Ʈ  ݱ    , c 
+void client_finish(Client* c) {
+    int client_sock = c->sock;
+    int client_type = c->type;
+    const char* room_number = c->room_number;
+    end_image_upload(&c->upload);
+    client_unregister(c->self);
 
-    // Ŭ̾Ʈ  ݱ    
-    RoomNode* room_node = find_room_node(room_number);
     if (client_type == CLIENT_TYPE_ESP) {
-        if (room_node) room_node->esp_sock = -1; // ESP32  ʱ
 	printf("ESP close\n");
+        bus_publish(BUS_DISCONNECTED, room_number, "esp");
     }
     else if (client_type == CLIENT_TYPE_FR) {
-        if (room_node) room_node->fr_sock = -1; // FR  ʱȭ
 	printf("FR close\n");
+        bus_publish(BUS_DISCONNECTED, room_number, "fr");
     }
 	else if (client_type == CLIENT_TYPE_WEB){
-		close(client_sock);
-		return NULL;
+		web_conn_close(c->web); //    ٸ   
+		slab_free(&client_slab, c);
+		return;
 	}
-    close(client_sock);
-    if ((room_node->fr_sock == -1) && (room_node->esp_sock == -1))
-        delete_room_node(room_number); //   
-    mysql_close(conn); // DB  
-    return NULL;
+    else if (client_type == CLIENT_TYPE_SUB) {
+        bus_unsubscribe(c->sub); //      
+        close(client_sock);
+        slab_free(&client_slab, c);
+        return;
+    }
+    if (c->node) {
+        room_detach(c->node, client_type, client_sock); //  ݱ    ȣ   򰥸 
+    }
+    close(client_sock);
+    slab_free(&client_slab, c);
 }
 
 void save_image_path(MYSQL* conn, const char* image_path, const char* room_number) {
     char query[BUF_SIZE] = { 0 };
+    if (!room_number_valid(room_number)) {
+        return;
+    }
     snprintf(query, sizeof(query), "INSERT INTO Stranger (RoomNO, Img_path) VALUES ('%s', '%s')", room_number, image_path);
 
     if (mysql_query(conn, query)) {
@@ -343,14 +1714,3454 @@ void save_image_path(MYSQL* conn, const char* image_path, const char* room_numbe
     }
 }
 
-void change_password(MYSQL* conn, const char* pw, const char* room_number) {
+int change_password(MYSQL* conn, const char* pw, const char* room_number) {
     char query[BUF_SIZE] = { 0 };
+    if (!room_number_valid(room_number) || strpbrk(pw, "'\\") != NULL) {
+        return -1; // йȣ ǥ ȿ ״ 
+    }
     snprintf(query, sizeof(query), "UPDATE Owner SET LoginPW ='%s' WHERE RoomNO = %s", pw, room_number);
 
     if (mysql_query(conn, query)) {
         fprintf(stderr, "Failed to update Password DB: %s\n", mysql_error(conn));
+        return -1;
+    }
+    printf("Change Password DB for room %s\n", room_number);
+    return 0;
+}
+
+int change_card(MYSQL* conn, const char* uid, const char* room_number, int add) {
+    char query[BUF_SIZE] = { 0 };
+    if (!room_number_valid(room_number)) {
+        return -1;
+    }
+    if (add) {
+        snprintf(query, sizeof(query), "INSERT INTO Card (RoomNO, UID) VALUES ('%s', '%s')", room_number, uid);
+    }
+    else {
+        snprintf(query, sizeof(query), "DELETE FROM Card WHERE RoomNO = %s AND UID = '%s'", room_number, uid);
+    }
+
+    if (mysql_query(conn, query)) {
+        fprintf(stderr, "Failed to update Card DB: %s\n", mysql_error(conn));
+        return -1;
+    }
+    printf("%s card %s DB for room %s\n", add ? "Add" : "Delete", uid, room_number);
+    return 0;
+}
+
+// ̹  Ȯ   , ̹  ƴϸ 0 ȯ
+//    : ":< ؽ 16>:< ũ>,<  ũ>,<߰  ũ>,< ũ>"
+int begin_image_upload(ImageUpload* up, const char* header) {
+    char status[32] = { 0 };
+    char phash_hex[17] = { 0 };
+    char parts[64] = { 0 };
+    unsigned long size = 0;
+    int fields = sscanf(header, "FR:room_%*[^:]:image:%31[^:]:%lu:%16[0-9a-f]:%63[0-9,]", status, &size, phash_hex, parts);
+    if (fields < 2) {
+        return 0;
+    }
+    memset(up, 0, sizeof(*up));
+    if (fields >= 3) {
+        up->phash = strtoull(phash_hex, NULL, 16);
+        up->has_phash = 1;
+    }
+    up->part_count = 1;
+    up->part_len[0] = size;
+    if (fields == 4) {
+        //  κ ũ  ü ũ   / 
+        size_t total = 0;
+        int count = 0;
+        char* save = NULL;
+        for (char* tok = strtok_r(parts, ",", &save); tok && count < IMAGE_PARTS; tok = strtok_r(NULL, ",", &save)) {
+            up->part_len[count] = strtoul(tok, NULL, 10);
+            total += up->part_len[count++];
+        }
+        if (total == size && count > 0 && up->part_len[0] > 0) {
+            up->part_count = count;
+        }
+        else {
+            memset(up->part_len, 0, sizeof(up->part_len));
+            up->part_len[0] = size;
+        }
+    }
+    if (size == 0 || size > MAX_IMAGE_SIZE) {
+        printf("FR: image size %lu rejected.\n", size);
+        up->active = 1;
+        up->discard = 1; // ʹ  ûũ о 
+        up->expected = MAX_IMAGE_SIZE;
+        return 1;
+    }
+    up->data = (unsigned char*)malloc(size);
+    if (!up->data) {
+        return 0;
+    }
+    strcpy(up->status, status);
+    up->expected = size;
+    up->active = 1;
+    return 1;
+}
+
+// ûũ  ̹  ó,  Ʈ  ȯ
+int feed_image_upload(ImageUpload* up, const char* data, int len) {
+    int used = 0;
+    while (used < len && !up->done) {
+        if (up->chunk_left == 0) {
+            // ûũ  ʵ(4Ʈ)
+            up->len_buf[up->len_have++] = (unsigned char)data[used++];
+            if (up->len_have < 4) continue;
+            up->len_have = 0;
+            up->chunk_left = ((uint32_t)up->len_buf[0] << 24) | ((uint32_t)up->len_buf[1] << 16) |
+                ((uint32_t)up->len_buf[2] << 8) | (uint32_t)up->len_buf[3];
+            if (up->chunk_left == 0) {
+                up->done = 1; //  ûũ
+                if (up->received != up->expected && !up->discard) up->error = 1;
+            }
+            else if (up->received + up->chunk_left > up->expected) {
+                up->error = 1;
+                up->done = 1;
+            }
+            continue;
+        }
+        int n = len - used;
+        if ((uint32_t)n > up->chunk_left) n = (int)up->chunk_left;
+        if (up->data) {
+            memcpy(up->data + up->received, data + used, n);
+        }
+        up->received += n;
+        up->chunk_left -= n;
+        used += n;
+    }
+    return used;
+}
+
+void end_image_upload(ImageUpload* up) {
+    free(up->data);
+    memset(up, 0, sizeof(*up));
+}
+
+// SHA-256 16 ڿ(IMAGE_HASH_LEN + 1 ũ )
+int sha256_hex(const void* data, size_t len, char* hex_out) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    if (!EVP_Digest(data, len, digest, &digest_len, EVP_sha256(), NULL)) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < digest_len; i++) {
+        sprintf(hex_out + i * 2, "%02x", digest[i]);
+    }
+    hex_out[IMAGE_HASH_LEN] = '\0';
+    return 0;
+}
+
+//  ؽ(SHA-256) ̹ ,   ̹  ٽ  
+int store_image(const unsigned char* data, size_t len, char* hash_out) {
+    if (sha256_hex(data, len, hash_out) < 0) {
+        fprintf(stderr, "image hash fail\n");
+        return -1;
+    }
+    return write_store_file(hash_out, image_part_suffix[0], data, len);
+}
+
+// ҿ ؽ ̸  (IMAGE_STORE_DIR/2/ؽ+̻), ̻翡 Ȯ 
+int write_store_file(const char* hash, const char* suffix, const unsigned char* data, size_t len) {
+    char dir[BUF_SIZE];
+    char path[BUF_SIZE * 2];
+    char tmp_path[BUF_SIZE * 2];
+    snprintf(dir, sizeof(dir), "%s/%.2s", IMAGE_STORE_DIR, hash);
+    snprintf(path, sizeof(path), "%s/%s%s", dir, hash, suffix);
+    if (access(path, F_OK) == 0) {
+        return 0; // ̹  ̹
+    }
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        perror("image dir fail");
+        return -1;
+    }
+
+    // ӽ Ͽ   rename ؼ      ʵ 
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s%s.%lu.tmp", dir, hash, suffix, (unsigned long)pthread_self());
+    FILE* fp = fopen(tmp_path, "wb");
+    if (!fp) {
+        perror("image open fail");
+        return -1;
+    }
+    size_t written = fwrite(data, 1, len, fp);
+    if (fclose(fp) != 0 || written != len || rename(tmp_path, path) == -1) {
+        perror("image write fail");
+        unlink(tmp_path);
+        return -1;
+    }
+    printf("Image stored %s%s (%zu bytes)\n", hash, suffix, len);
+    return 0;
+}
+
+//  濡 ֱٿ    ̹( ؽ Ÿ) ã  ؽø 
+int find_near_duplicate(const char* room_number, uint64_t phash, char* hash_out) {
+    int found = 0;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&image_mutex);
+    for (int i = 0; i < RECENT_IMAGE_COUNT; i++) {
+        RecentImage* r = &recent_images[i];
+        if (r->hash[0] == '\0' || now - r->stored_at > NEAR_DUP_SECONDS) continue;
+        if (strcmp(r->room_number, room_number) != 0) continue;
+        if (__builtin_popcountll(r->phash ^ phash) <= PHASH_MAX_DISTANCE) {
+            strcpy(hash_out, r->hash);
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&image_mutex);
+    return found;
+}
+
+void remember_image(const char* room_number, uint64_t phash, const char* hash) {
+    pthread_mutex_lock(&image_mutex);
+    RecentImage* r = &recent_images[recent_image_next];
+    recent_image_next = (recent_image_next + 1) % RECENT_IMAGE_COUNT;
+    strncpy(r->room_number, room_number, sizeof(r->room_number) - 1);
+    r->phash = phash;
+    r->stored_at = time(NULL);
+    strcpy(r->hash, hash);
+    pthread_mutex_unlock(&image_mutex);
+}
+
+//  ̹   :  ߺ̸  ̹ ؽø , ƴϸ  ,  
+int store_upload(const char* room_number, ImageUpload* up, char* hash_out) {
+    if (up->has_phash && find_near_duplicate(room_number, up->phash, hash_out)) {
+        printf("Image near duplicate in room %s, reuse %s\n", room_number, hash_out);
+        return 0;
+    }
+    if (store_image(up->data, up->part_len[0], hash_out) != 0) {
+        return -1;
+    }
+    size_t offset = up->part_len[0];
+    for (int i = 1; i < up->part_count; i++) {
+        if (up->part_len[i] > 0) { // FR   κ 0Ʈ
+            write_store_file(hash_out, image_part_suffix[i], up->data + offset, up->part_len[i]);
+        }
+        offset += up->part_len[i];
+    }
+    if (up->has_phash) {
+        remember_image(room_number, up->phash, hash_out);
+    }
+    return 0;
+}
+
+long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//   ð(н ð ms)
+long long epoch_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 溰 ĸó/ ̺Ʈ   :   ߺ ġ, ū  
+int allow_room_event(RoomNode* node, int kind) {
+    static const char* kind_name[EVENT_KIND_COUNT] = { "capture request", "failure", "capture" };
+    long long now = now_ms();
+    int allowed = 0;
+
+    pthread_mutex_lock(&node->lock);
+    node->event_tokens += (now - node->token_refill_ms) / 1000.0 * EVENT_REFILL_PER_SEC;
+    if (node->event_tokens > EVENT_BUCKET_SIZE) node->event_tokens = EVENT_BUCKET_SIZE;
+    node->token_refill_ms = now;
+
+    if (node->last_event_ms[kind] != 0 && now - node->last_event_ms[kind] < COALESCE_MS) {
+        node->dropped_events++;
+        printf("room %s %s coalesced (dropped %u)\n", node->room_number, kind_name[kind], node->dropped_events);
+    }
+    else if (node->event_tokens < 1.0) {
+        node->dropped_events++;
+        printf("room %s %s rate limited (dropped %u)\n", node->room_number, kind_name[kind], node->dropped_events);
+    }
+    else {
+        node->event_tokens -= 1.0;
+        node->last_event_ms[kind] = now;
+        allowed = 1;
+    }
+    pthread_mutex_unlock(&node->lock);
+    return allowed;
+}
+
+//  ESP/FR  ޽ ,   ⸸ ȭ(ٸ   ٸ )
+int room_send(RoomNode* node, int target, const char* msg) {
+    int result = -1;
+    pthread_mutex_lock(&node->lock);
+    int sock = (target == TARGET_ESP) ? node->esp_sock : node->fr_sock;
+    if (sock > 0) {
+        result = (write(sock, msg, strlen(msg)) < 0) ? -1 : 0;
+    }
+    pthread_mutex_unlock(&node->lock);
+    return result;
+}
+
+// ׷ ̸ شϴ    : building, floor_<>, rooms_<>,<>...
+int collect_group_rooms(const char* group, FanoutTarget** out) {
+    int count = 0;
+    int capacity = 64;
+    FanoutTarget* targets = (FanoutTarget*)calloc(capacity, sizeof(FanoutTarget));
+
+    if (strncmp(group, "rooms_", 6) == 0) {
+        //    :   浵  ( ȣ û   Ȯ ⼭ Ÿ)
+        if (!room_list_valid(group + 6)) {
+            free(targets);
+            *out = NULL;
+            return -1;
+        }
+        char* list = strdup(group + 6);
+        char* save = NULL;
+        for (char* tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+            if (count == capacity) {
+                capacity *= 2;
+                targets = (FanoutTarget*)realloc(targets, capacity * sizeof(FanoutTarget));
+            }
+            memset(&targets[count], 0, sizeof(FanoutTarget));
+            strncpy(targets[count].room_number, tok, sizeof(targets[count].room_number) - 1);
+            count++;
+        }
+        free(list);
+        *out = targets;
+        return count;
+    }
+
+    int floor = -1;
+    if (strncmp(group, "floor_", 6) == 0) {
+        floor = atoi(group + 6);
+    }
+    else if (strcmp(group, "building") != 0) {
+        free(targets);
+        *out = NULL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&room_table_mutex);
+    for (RoomNode* current = room_table; current != NULL; current = current->next) {
+        if (floor >= 0 && atoi(current->room_number) / 100 != floor) continue; // 201ȣ -> 2
+        if (count == capacity) {
+            capacity *= 2;
+            targets = (FanoutTarget*)realloc(targets, capacity * sizeof(FanoutTarget));
+        }
+        memset(&targets[count], 0, sizeof(FanoutTarget));
+        strcpy(targets[count].room_number, current->room_number);
+        count++;
+    }
+    pthread_mutex_unlock(&room_table_mutex);
+    *out = targets;
+    return count;
+}
+
+void* fanout_worker(void* arg) {
+    FanoutJob* job = (FanoutJob*)arg;
+    for (int i = job->begin; i < job->end; i++) {
+        FanoutTarget* t = &job->targets[i];
+        RoomNode* node = room_node_hold(t->room_number); //       ̹   
+        unsigned int id = node ? send_room_command(node, job->msg, NULL, NULL, job->group, t) : 0;
+        room_node_release(node);
+        if (id != 0) {
+            continue; //  ESP  Ǵ ð ʰ  ä
+        }
+        pthread_mutex_lock(&pending_mutex);
+        t->result = CMD_OFFLINE;
+        if (--job->group->remaining == 0) pthread_cond_broadcast(&job->group->done);
+        pthread_mutex_unlock(&pending_mutex);
+    }
+    return NULL;
+}
+
+//  Ͽ    ÿ ϰ   ACK/NACK/ð ʰ ٸ,  targets[i].result
+void fanout_command(FanoutTarget* targets, int count, const char* msg) {
+    GroupWait group;
+    group.remaining = count;
+    pthread_cond_init(&group.done, NULL);
+    for (int i = 0; i < count; i++) targets[i].result = CMD_PENDING;
+
+    if (count < FANOUT_PARALLEL_MIN) {
+        FanoutJob job = { targets, 0, count, msg, &group };
+        fanout_worker(&job);
+    }
+    else {
+        fanout_parallel(targets, count, msg, &group);
+    }
+
+    pthread_mutex_lock(&pending_mutex);
+    while (group.remaining > 0) {
+        pthread_cond_wait(&group.done, &pending_mutex);
+    }
+    pthread_mutex_unlock(&pending_mutex);
+    pthread_cond_destroy(&group.done);
+}
+
+void fanout_parallel(FanoutTarget* targets, int count, const char* msg, GroupWait* group) {
+    pthread_t tids[FANOUT_THREADS];
+    FanoutJob jobs[FANOUT_THREADS];
+    int per_thread = (count + FANOUT_THREADS - 1) / FANOUT_THREADS;
+    int started = 0;
+    for (int i = 0; i < FANOUT_THREADS && i * per_thread < count; i++) {
+        jobs[i].targets = targets;
+        jobs[i].begin = i * per_thread;
+        jobs[i].end = (i + 1) * per_thread < count ? (i + 1) * per_thread : count;
+        jobs[i].msg = msg;
+        jobs[i].group = group;
+        if (pthread_create(&tids[i], NULL, fanout_worker, &jobs[i]) != 0) {
+            fanout_worker(&jobs[i]); // 带    ó
+            continue;
+        }
+        started |= 1 << i;
+    }
+    for (int i = 0; i < FANOUT_THREADS; i++) {
+        if (started & (1 << i)) pthread_join(tids[i], NULL);
+    }
+}
+
+//    ó      , Ŭ͸ ٸ   ؼ  ħ
+//  : "WEB:<׷>:<>:ok=<ACK >:fail=< >:timeout=<ð ʰ >:ms=<ɸ ð>:rooms=< ,...>[:down=<  ,...>]\n"
+void handle_group_message(WebConn* web, const char* tag, const char* group, const char* status) {
+    char error[BUF_SIZE * 3];
+    snprintf(error, sizeof(error), "WEB:%s:%s:error\n", group, status);
+    if (strcmp(status, "open") != 0) {
+        printf("WEB : unknown group command %s.\n", status);
+        web_reply(web, tag, error);
+        return;
+    }
+
+    GroupResult result = { 0 };
+    long long start = now_ms();
+    unsigned int forward_ids[MAX_CLUSTER_NODES] = { 0 };
+    char* local_group = strdup(group);
+
+    if (cluster_count > 1 && !web->peer) {
+        // 庰 û  :    庰 , /ǹ  尡 ڱ  ó
+        char* node_rooms[MAX_CLUSTER_NODES] = { 0 };
+        if (strncmp(group, "rooms_", 6) == 0) {
+            char* list = strdup(group + 6);
+            char* save = NULL;
+            for (char* tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+                append_list(&node_rooms[strlen(tok) < 10 ? owner_node(tok) : self_node], tok);
+            }
+            free(list);
+            free(local_group);
+            local_group = NULL;
+            if (node_rooms[self_node]) {
+                local_group = (char*)malloc(strlen(node_rooms[self_node]) + 8);
+                sprintf(local_group, "rooms_%s", node_rooms[self_node]);
+            }
+        }
+        for (int n = 0; n < cluster_count; n++) {
+            if (n == self_node) continue;
+            char* sub_group = NULL;
+            if (strncmp(group, "rooms_", 6) == 0) {
+                if (!node_rooms[n]) continue;
+                sub_group = (char*)malloc(strlen(node_rooms[n]) + 8);
+                sprintf(sub_group, "rooms_%s", node_rooms[n]);
+            }
+            else {
+                sub_group = strdup(group);
+            }
+            size_t line_size = strlen(sub_group) + strlen(status) + 8;
+            char* line = (char*)malloc(line_size);
+            snprintf(line, line_size, "WEB:%s:%s", sub_group, status);
+            forward_ids[n] = forward_send(n, line, NULL, NULL, "", status);
+            if (forward_ids[n] == 0) {
+                //   :  ̸   , /ǹ̸ 常 ǥ
+                if (node_rooms[n]) {
+                    append_list(&result.failed, node_rooms[n]);
+                    for (char* c = node_rooms[n]; c; c = strchr(c + 1, ',')) result.fail++;
+                }
+                append_list(&result.down, cluster_nodes[n].addr);
+            }
+            free(line);
+            free(sub_group);
+        }
+        for (int n = 0; n < cluster_count; n++) free(node_rooms[n]);
+    }
+
+    if (local_group && run_local_group(local_group, status, &result) < 0) {
+        printf("WEB : unknown group %s.\n", group);
+        web_reply(web, tag, error);
+        for (int n = 0; n < cluster_count; n++) {
+            if (forward_ids[n]) free(forward_wait(forward_ids[n], 0));
+        }
+        free(local_group);
+        free(result.failed);
+        free(result.down);
+        return;
+    }
+    free(local_group);
+
+    for (int n = 0; n < cluster_count; n++) {
+        if (!forward_ids[n]) continue;
+        char* reply = forward_wait(forward_ids[n], FORWARD_TIMEOUT_MS);
+        if (reply && strstr(reply, ":ok=")) {
+            merge_group_reply(&result, reply);
+        }
+        else {
+            append_list(&result.down, cluster_nodes[n].addr);
+        }
+        free(reply);
+    }
+
+    long long elapsed = now_ms() - start;
+    int count = result.ok + result.fail;
+    printf("WEB : %s %s acked by %d/%d rooms in %lld ms.\n", group, status, result.ok, count, elapsed);
+    size_t resp_size = BUF_SIZE * 2 + (result.failed ? strlen(result.failed) : 0) + (result.down ? strlen(result.down) : 0);
+    char* resp = (char*)malloc(resp_size);
+    int len = snprintf(resp, resp_size, "WEB:%s:%s:ok=%d:fail=%d:timeout=%d:ms=%lld:rooms=%s",
+        group, status, result.ok, result.fail, result.timeouts, elapsed, result.failed ? result.failed : "");
+    if (result.down) {
+        len += snprintf(resp + len, resp_size - len, ":down=%s", result.down);
+    }
+    snprintf(resp + len, resp_size - len, "\n");
+    web_reply(web, tag, resp);
+    free(resp);
+    free(result.failed);
+    free(result.down);
+}
+
+//  忡  濡    ,    ׷̸ -1
+int run_local_group(const char* group, const char* status, GroupResult* result) {
+    FanoutTarget* targets = NULL;
+    int count = collect_group_rooms(group, &targets);
+    if (count < 0) {
+        return -1;
+    }
+
+    long long start = now_ms();
+    fanout_command(targets, count, status);
+    for (int i = 0; i < count; i++) {
+        if (targets[i].result == CMD_ACK) {
+            result->ok++;
+        }
+        else {
+            result->fail++;
+            if (targets[i].result == CMD_TIMEOUT) result->timeouts++;
+            append_list(&result->failed, targets[i].room_number);
+        }
+    }
+    result->ms = now_ms() - start;
+    free(targets);
+    return 0;
+}
+
+// ٸ       
+void merge_group_reply(GroupResult* result, const char* reply) {
+    int ok = 0, fail = 0, timeouts = 0;
+    long long ms = 0;
+    if (sscanf(strstr(reply, ":ok="), ":ok=%d:fail=%d:timeout=%d:ms=%lld", &ok, &fail, &timeouts, &ms) != 4) {
+        return;
+    }
+    result->ok += ok;
+    result->fail += fail;
+    result->timeouts += timeouts;
+    if (ms > result->ms) result->ms = ms;
+    const char* rooms = strstr(reply, ":rooms=");
+    if (rooms) {
+        rooms += 7;
+        size_t len = strcspn(rooms, ":\r\n");
+        if (len > 0) {
+            char* list = strndup(rooms, len);
+            append_list(&result->failed, list);
+            free(list);
+        }
+    }
+}
+
+// ǥ Ͽ ׸ ߰(ʿϸ  Ҵ)
+void append_list(char** list, const char* item) {
+    size_t old_len = *list ? strlen(*list) : 0;
+    char* grown = (char*)realloc(*list, old_len + strlen(item) + 2);
+    if (!grown) return;
+    if (old_len > 0) {
+        grown[old_len] = ',';
+        strcpy(grown + old_len + 1, item);
+    }
+    else {
+        strcpy(grown, item);
+    }
+    *list = grown;
+}
+
+void* group_request_thread(void* arg) {
+    GroupRequest* req = (GroupRequest*)arg;
+    handle_group_message(req->web, req->tag, req->group, req->status);
+    web_conn_release(req->web);
+    free(req);
+    return NULL;
+}
+
+//   , gateway ̺Ʈ Ǫ 
+WebConn* web_conn_open(int sock, int gateway) {
+    WebConn* web = (WebConn*)slab_zalloc(&web_slab);
+    web->sock = sock;
+    web->gateway = gateway;
+    pthread_mutex_init(&web->write_lock, NULL);
+    if (gateway) {
+        web->sub = bus_subscribe(sock, &web->write_lock, BUS_ALL_KINDS, "", DROP_OLDEST);
+    }
+    pthread_mutex_lock(&web_conn_mutex);
+    web->next = web_conns;
+    web_conns = web;
+    pthread_mutex_unlock(&web_conn_mutex);
+    return web;
+}
+
+//    :   ESP   ϰ, ó       ٸ  
+void web_conn_close(WebConn* web) {
+    cancel_web_commands(web);
+    pthread_mutex_lock(&web_conn_mutex);
+    while (web->inflight > 0) {
+        pthread_cond_wait(&web_idle, &web_conn_mutex);
+    }
+    WebConn** pp = &web_conns;
+    while (*pp && *pp != web) pp = &(*pp)->next;
+    if (*pp) *pp = web->next;
+    pthread_mutex_unlock(&web_conn_mutex);
+    if (web->sub) bus_unsubscribe(web->sub);
+    close(web->sock);
+    pthread_mutex_destroy(&web->write_lock);
+    slab_free(&web_slab, web);
+}
+
+void web_conn_hold(WebConn* web) {
+    pthread_mutex_lock(&web_conn_mutex);
+    web->inflight++;
+    pthread_mutex_unlock(&web_conn_mutex);
+}
+
+void web_conn_release(WebConn* web) {
+    pthread_mutex_lock(&web_conn_mutex);
+    if (--web->inflight == 0) pthread_cond_broadcast(&web_idle);
+    pthread_mutex_unlock(&web_conn_mutex);
+}
+
+// Ͽ  ,   write_lock  ¿ ȣ
+int web_write_all(int sock, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+//   ,  (,   , ESP  ó) Ƿ    پ, ±װ  տ 
+void web_reply(WebConn* web, const char* tag, const char* msg) {
+    char line[BUF_SIZE * 4];
+    const char* out = msg;
+    int split = 0; //  (  ) ±׿   
+    if (tag && tag[0] != '\0') {
+        split = snprintf(line, sizeof(line), "@%s %s", tag, msg) >= (int)sizeof(line);
+        if (split) snprintf(line, sizeof(line), "@%s ", tag);
+        out = line;
+    }
+    pthread_mutex_lock(&web->write_lock);
+    web_write_all(web->sock, out, strlen(out));
+    if (split) web_write_all(web->sock, msg, strlen(msg));
+    pthread_mutex_unlock(&web->write_lock);
+}
+
+// ESP ID       Ͽ ,    0 ȯ
+unsigned int send_room_command(RoomNode* node, const char* command, WebConn* web, const char* tag, GroupWait* group, FanoutTarget* target) {
+    pthread_mutex_lock(&pending_mutex);
+    unsigned int id;
+    PendingCommand* p;
+    for (;;) {
+        id = next_command_id++;
+        if (next_command_id == 0) next_command_id = 1;
+        p = &pending_commands[id % MAX_PENDING_COMMANDS];
+        if (p->id == 0) break;
+        //     ڸ ϰ  ð ʰ ó
+        unsigned int old_id = p->id;
+        char old_room[10];
+        strcpy(old_room, p->room_number);
+        pthread_mutex_unlock(&pending_mutex);
+        resolve_command(old_id, old_room, CMD_TIMEOUT, NULL);
+        pthread_mutex_lock(&pending_mutex);
+        if (p->id == 0) break; //  Ǭ  ٸ   ڸ   ID ٽ
+    }
+    p->id = id;
+    strcpy(p->room_number, node->room_number);
+    strncpy(p->command, command, sizeof(p->command) - 1);
+    p->command[sizeof(p->command) - 1] = '\0';
+    p->sent_ms = now_ms();
+    p->web = web;
+    if (web) web_conn_hold(web);
+    strncpy(p->tag, tag ? tag : "", sizeof(p->tag) - 1);
+    p->tag[sizeof(p->tag) - 1] = '\0';
+    p->group = group;
+    p->target = target;
+    pthread_mutex_unlock(&pending_mutex);
+
+    if (strcmp(command, "open") == 0) {
+        room_state_set_door(node->room_number, "opening");
+    }
+
+    char msg[BUF_SIZE];
+    snprintf(msg, sizeof(msg), "%s:%u\n", command, id);
+    if (room_send(node, TARGET_ESP, msg) < 0) {
+        pthread_mutex_lock(&pending_mutex);
+        if (p->id == id) {
+            p->id = 0;
+            if (p->web) web_conn_release(p->web);
+        }
+        pthread_mutex_unlock(&pending_mutex);
+        return 0;
+    }
+    return id;
+}
+
+// ESP (ACK/NACK) Ǵ ð ʰ  Ϸ : 溰 պ ð , /  ɿ  
+void resolve_command(unsigned int id, const char* room_number, int result, const char* reason) {
+    static const char* result_name[] = { "ack", "offline", "nack", "timeout" };
+
+    pthread_mutex_lock(&pending_mutex);
+    PendingCommand* p = &pending_commands[id % MAX_PENDING_COMMANDS];
+    if (id == 0 || p->id != id || strcmp(p->room_number, room_number) != 0) {
+        pthread_mutex_unlock(&pending_mutex);
+        printf("room %s unknown command id %u.\n", room_number, id);
+        return;
+    }
+    PendingCommand done = *p;
+    p->id = 0;
+    long long rtt = now_ms() - done.sent_ms;
+    if (done.target) {
+        done.target->result = result;
+        if (--done.group->remaining == 0) pthread_cond_broadcast(&done.group->done);
+    }
+    pthread_mutex_unlock(&pending_mutex);
+
+    RoomNode* node = room_node_hold(room_number); // ESP    ð ʰ 忡 
+    if (node) {
+        pthread_mutex_lock(&node->lock);
+        if (result == CMD_TIMEOUT) {
+            node->cmd_timeouts++;
+        }
+        else {
+            if (result == CMD_ACK) node->cmd_acked++;
+            else node->cmd_nacked++;
+            node->cmd_rtt_last_ms = rtt;
+            node->cmd_rtt_avg_ms = (node->cmd_acked + node->cmd_nacked == 1) ? rtt :
+                node->cmd_rtt_avg_ms * (1.0 - RTT_EWMA_WEIGHT) + rtt * RTT_EWMA_WEIGHT;
+            if (rtt > node->cmd_rtt_max_ms) node->cmd_rtt_max_ms = rtt;
+        }
+        pthread_mutex_unlock(&node->lock);
+        room_node_release(node);
+        persist_mark(room_number);
+    }
+    printf("room %s %s:%u %s in %lld ms%s%s\n", room_number, done.command, id, result_name[-result], rtt,
+        reason ? " : " : "", reason ? reason : "");
+
+    if (strcmp(done.command, "open") == 0) {
+        // ACK  ȴ ٽ  ڿ Ƿ ,     
+        room_state_set_door(room_number, result == CMD_TIMEOUT ? "unknown" : "locked");
+        if (result == CMD_ACK) bus_publish(BUS_DOOR_OPENED, room_number, NULL);
+    }
+    if (done.web) {
+        char reply[BUF_SIZE];
+        if (result == CMD_NACK) {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:%s:nack:%u:%s\n", room_number, done.command, id, reason ? reason : "");
+        }
+        else {
+            snprintf(reply, sizeof(reply), "WEB:room_%s:%s:%s:%u:%lld\n", room_number, done.command, result_name[-result], id, rtt);
+        }
+        web_reply(done.web, done.tag, reply);
+        web_conn_release(done.web);
+    }
+}
+
+//        ( ü  )
+void cancel_web_commands(WebConn* web) {
+    pthread_mutex_lock(&pending_mutex);
+    for (int i = 0; i < MAX_PENDING_COMMANDS; i++) {
+        if (pending_commands[i].id != 0 && pending_commands[i].web == web) {
+            pending_commands[i].web = NULL;
+            web_conn_release(web);
+        }
+    }
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+// COMMAND_TIMEOUT_MS     ð ʰ ó
+void* command_timeout_thread(void* arg) {
+    while (1) {
+        usleep(100 * 1000);
+        long long now = now_ms();
+        for (int i = 0; i < MAX_PENDING_COMMANDS; i++) {
+            pthread_mutex_lock(&pending_mutex);
+            unsigned int id = pending_commands[i].id;
+            char room_number[10];
+            strcpy(room_number, pending_commands[i].room_number);
+            int expired = id != 0 && now - pending_commands[i].sent_ms > COMMAND_TIMEOUT_MS;
+            pthread_mutex_unlock(&pending_mutex);
+            if (expired) {
+                resolve_command(id, room_number, CMD_TIMEOUT, NULL);
+            }
+        }
+        for (int i = 0; i < MAX_FORWARDS; i++) {
+            // ٸ   û    ٷ ϴ (ٸ 尡  )
+            pthread_mutex_lock(&forward_mutex);
+            unsigned int id = forwards[i].id;
+            int expired = id != 0 && forwards[i].web && now - forwards[i].sent_ms > FORWARD_TIMEOUT_MS;
+            pthread_mutex_unlock(&forward_mutex);
+            if (expired) {
+                forward_finish(id, NULL);
+            }
+        }
+    }
+    return NULL;
+}
+
+//      
+Subscriber* bus_subscribe(int sock, pthread_mutex_t* write_lock, unsigned int kinds, const char* room_number, int policy) {
+    Subscriber* sub = (Subscriber*)calloc(1, sizeof(Subscriber));
+    sub->sock = sock;
+    sub->write_lock = write_lock;
+    sub->kinds = kinds;
+    strncpy(sub->room_number, room_number, sizeof(sub->room_number) - 1);
+    sub->policy = policy;
+    pthread_mutex_init(&sub->lock, NULL);
+    pthread_cond_init(&sub->ready, NULL);
+    if (pthread_create(&sub->writer, NULL, bus_writer_thread, sub) != 0) {
+        pthread_mutex_destroy(&sub->lock);
+        pthread_cond_destroy(&sub->ready);
+        free(sub);
+        return NULL;
+    }
+    pthread_mutex_lock(&bus_mutex);
+    sub->next = subscribers;
+    subscribers = sub;
+    pthread_mutex_unlock(&bus_mutex);
+    return sub;
+}
+
+//  λ縻 "SUB:<,...|all>:<|all>:<å>" ؼ  
+Subscriber* bus_subscribe_request(int sock, const char* request) {
+    char kinds_str[BUF_SIZE] = { 0 };
+    char room[BUF_SIZE] = { 0 };
+    char policy_str[BUF_SIZE] = { 0 };
+    sscanf(request, "SUB:%255[^:]:%255[^:]:%255[^:\r\n]", kinds_str, room, policy_str);
+
+    unsigned int kinds = 0;
+    if (kinds_str[0] == '\0' || strcmp(kinds_str, "all") == 0) {
+        kinds = BUS_ALL_KINDS;
     }
     else {
-        printf("Change Password DB for room %s\n", room_number);
+        char* save = NULL;
+        for (char* name = strtok_r(kinds_str, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+            for (int k = 0; k < BUS_KIND_COUNT; k++) {
+                if (strcmp(name, bus_kind_name[k]) == 0) kinds |= 1u << k;
+            }
+        }
+    }
+
+    const char* room_number = "";
+    if (strncmp(room, "room_", 5) == 0 && strlen(room + 5) < 10) {
+        room_number = room + 5;
+    }
+
+    int policy = DROP_OLDEST;
+    if (strcmp(policy_str, "drop_newest") == 0) policy = DROP_NEWEST;
+    else if (strcmp(policy_str, "disconnect") == 0) policy = DROP_DISCONNECT;
+
+    return bus_subscribe(sock, NULL, kinds, room_number, policy);
+}
+
+//   : Ͽ   尡  ̺Ʈ    ٸ( ȣ ʿ )
+void bus_unsubscribe(Subscriber* sub) {
+    if (!sub) return;
+    pthread_mutex_lock(&bus_mutex);
+    Subscriber** pp = &subscribers;
+    while (*pp && *pp != sub) pp = &(*pp)->next;
+    if (*pp) *pp = sub->next;
+    pthread_mutex_unlock(&bus_mutex);
+
+    pthread_mutex_lock(&sub->lock);
+    sub->closing = 1;
+    pthread_cond_signal(&sub->ready);
+    pthread_mutex_unlock(&sub->lock);
+    if (!sub->paused) pthread_join(sub->writer, NULL);
+    if (sub->dropped_total > 0) {
+        printf("SUB : subscriber dropped %u events.\n", sub->dropped_total);
+    }
+    pthread_mutex_destroy(&sub->lock);
+    pthread_cond_destroy(&sub->ready);
+    free(sub);
+}
+
+//   :   ť    带 (   ѱ   )
+//   bus_mutex  Ƿ  ä ٷ 
+void bus_pause(void) {
+    pthread_mutex_lock(&bus_mutex);
+    for (Subscriber* sub = subscribers; sub; sub = sub->next) {
+        pthread_mutex_lock(&sub->lock);
+        sub->paused = 1;
+        pthread_cond_signal(&sub->ready);
+        pthread_mutex_unlock(&sub->lock);
+    }
+    for (Subscriber* sub = subscribers; sub; sub = sub->next) {
+        pthread_join(sub->writer, NULL);
     }
+    pthread_mutex_unlock(&bus_mutex);
+}
+
+// ѱ  :  带 ٽ ,    ̺Ʈ 
+void bus_resume(void) {
+    pthread_mutex_lock(&bus_mutex);
+    for (Subscriber* sub = subscribers; sub; sub = sub->next) {
+        if (!sub->paused) continue;
+        sub->paused = 0;
+        if (pthread_create(&sub->writer, NULL, bus_writer_thread, sub) != 0) {
+            sub->paused = 1; //   (bus_unsubscribe ٸ )
+            shutdown(sub->sock, SHUT_RDWR); // б 尡    
+        }
+    }
+    pthread_mutex_unlock(&bus_mutex);
+}
+
+// ̺Ʈ  :  ´  ť ֱ⸸ ϰ ٷ ȯ(  ں  )
+void bus_publish(int kind, const char* room_number, const char* value) {
+    char line[BUS_LINE_LEN];
+    snprintf(line, sizeof(line), "EVENT:room_%s:%s%s%s\n", room_number, bus_kind_name[kind],
+        value ? ":" : "", value ? value : "");
+
+    room_state_on_event(kind, room_number, value);
+
+    pthread_mutex_lock(&bus_mutex);
+    for (Subscriber* sub = subscribers; sub; sub = sub->next) {
+        if (!(sub->kinds & (1u << kind))) continue;
+        if (sub->room_number[0] != '\0' && strcmp(sub->room_number, room_number) != 0) continue;
+
+        pthread_mutex_lock(&sub->lock);
+        if (sub->count == BUS_QUEUE_SIZE) {
+            sub->dropped++;
+            sub->dropped_total++;
+            if (sub->policy == DROP_OLDEST) {
+                sub->head = (sub->head + 1) % BUS_QUEUE_SIZE;
+                sub->count--;
+            }
+            else if (sub->policy == DROP_DISCONNECT && !sub->closing && !sub->paused) {
+                shutdown(sub->sock, SHUT_RDWR); // б 尡    
+            }
+        }
+        if (sub->count < BUS_QUEUE_SIZE) {
+            memcpy(sub->queue[(sub->head + sub->count) % BUS_QUEUE_SIZE], line, sizeof(line));
+            sub->count++;
+            pthread_cond_signal(&sub->ready);
+        }
+        pthread_mutex_unlock(&sub->lock);
+    }
+    pthread_mutex_unlock(&bus_mutex);
+}
+
+// ں   : ť  ̺Ʈ Ƽ   
+void* bus_writer_thread(void* arg) {
+    Subscriber* sub = (Subscriber*)arg;
+    char batch[(BUS_WRITE_BATCH + 1) * BUS_LINE_LEN];
+
+    while (1) {
+        pthread_mutex_lock(&sub->lock);
+        while (sub->count == 0 && !sub->closing && !sub->paused) {
+            pthread_cond_wait(&sub->ready, &sub->lock);
+        }
+        if ((sub->closing || sub->paused) && sub->count == 0) {
+            pthread_mutex_unlock(&sub->lock);
+            break; //  ̺Ʈ    
+        }
+        size_t len = 0;
+        if (sub->dropped > 0) {
+            len += snprintf(batch, BUS_LINE_LEN, "EVENT:bus:dropped:%u\n", sub->dropped);
+            sub->dropped = 0;
+        }
+        for (int i = 0; i < BUS_WRITE_BATCH && sub->count > 0; i++) {
+            const char* line = sub->queue[sub->head];
+            size_t line_len = strlen(line);
+            memcpy(batch + len, line, line_len);
+            len += line_len;
+            sub->head = (sub->head + 1) % BUS_QUEUE_SIZE;
+            sub->count--;
+        }
+        pthread_mutex_unlock(&sub->lock);
+
+        if (sub->write_lock) pthread_mutex_lock(sub->write_lock);
+        int result = web_write_all(sub->sock, batch, len);
+        if (sub->write_lock) pthread_mutex_unlock(sub->write_lock);
+        if (result < 0) {
+            break; //  ,  б 忡
+        }
+    }
+    return NULL;
+}
+
+unsigned int room_state_bucket(const char* room_number) {
+    unsigned int h = 2166136261u; // FNV-1a
+    for (const char* c = room_number; *c; c++) {
+        h = (h ^ (unsigned char)*c) * 16777619u;
+    }
+    return h % ROOM_STATE_BUCKETS;
+}
+
+// room_state_lock  ¿ ȣ
+RoomState* room_state_find(const char* room_number) {
+    for (RoomState* st = room_states[room_state_bucket(room_number)]; st; st = st->next) {
+        if (strcmp(st->room_number, room_number) == 0) return st;
+    }
+    return NULL;
+}
+
+//    ¿ ȣ,   
+RoomState* room_state_find_or_add(const char* room_number) {
+    RoomState* st = room_state_find(room_number);
+    if (st) return st;
+    st = (RoomState*)calloc(1, sizeof(RoomState));
+    strcpy(st->room_number, room_number);
+    st->door = "unknown";
+    st->last_event = -1;
+    st->cred_version = (uint32_t)time(NULL); //  ٽ ϸ    ESP ü ȭ
+    st->cred_log_base = st->cred_version;
+    unsigned int b = room_state_bucket(room_number);
+    st->next = room_states[b];
+    room_states[b] = st;
+    return st;
+}
+
+// DB  йȣ о ؽ÷ ( ޸𸮿  ), ó   DB ȸ
+RoomState* room_state_get(const char* room_number, MYSQL* conn) {
+    if (!room_number_valid(room_number)) {
+        return NULL;
+    }
+    pthread_rwlock_rdlock(&room_state_lock);
+    RoomState* st = room_state_find(room_number);
+    int loaded = st && st->pw_loaded && st->uids_loaded;
+    pthread_rwlock_unlock(&room_state_lock);
+    if (loaded || !conn) {
+        return st;
+    }
+
+    char query[BUF_SIZE];
+    char hash[IMAGE_HASH_LEN + 1] = { 0 };
+    char salt[CRED_SALT_LEN + 1] = { 0 };
+    char salted[IMAGE_HASH_LEN + 1] = { 0 };
+    int found = 0;
+    snprintf(query, sizeof(query), "SELECT LoginPW FROM Owner WHERE RoomNO = %s", room_number);
+    if (mysql_query(conn, query)) {
+        fprintf(stderr, "Failed to load room %s state: %s\n", room_number, mysql_error(conn));
+    }
+    else {
+        MYSQL_RES* res = mysql_store_result(conn);
+        MYSQL_ROW row = res ? mysql_fetch_row(res) : NULL;
+        if (row && row[0]) {
+            found = sha256_hex(row[0], strlen(row[0]), hash) == 0 && cred_new_salt(salt) == 0 &&
+                cred_salted_hash(salt, row[0], salted) == 0;
+        }
+        if (res) mysql_free_result(res);
+    }
+
+    char uids[CRED_MAX_UIDS][CRED_UID_LEN + 1];
+    int uid_count = 0;
+    int uids_found = 0;
+    snprintf(query, sizeof(query), "SELECT UID FROM Card WHERE RoomNO = %s", room_number);
+    if (mysql_query(conn, query)) {
+        fprintf(stderr, "Failed to load room %s cards: %s\n", room_number, mysql_error(conn));
+    }
+    else {
+        MYSQL_RES* res = mysql_store_result(conn);
+        if (res) {
+            MYSQL_ROW row;
+            while ((row = mysql_fetch_row(res)) && uid_count < CRED_MAX_UIDS) {
+                if (row[0] && cred_uid_normalize(row[0], uids[uid_count]) == 0) uid_count++;
+            }
+            mysql_free_result(res);
+            uids_found = 1;
+        }
+    }
+
+    pthread_rwlock_wrlock(&room_state_lock);
+    st = room_state_find_or_add(room_number);
+    int changed = 0;
+    if (found && !st->pw_loaded) {
+        strcpy(st->pw_hash, hash);
+        strcpy(st->pw_salt, salt);
+        strcpy(st->pw_salted, salted);
+        st->pw_loaded = 1;
+        changed = 1;
+    }
+    if (uids_found && !st->uids_loaded) {
+        memcpy(st->uids, uids, sizeof(uids));
+        st->uid_count = uid_count;
+        st->uids_loaded = 1;
+        changed = 1;
+    }
+    if (changed) {
+        // DB       ø(   ESP ü ȭ)
+        st->cred_log_base = ++st->cred_version;
+    }
+    pthread_rwlock_unlock(&room_state_lock);
+    if (changed) persist_mark(room_number);
+    return st;
+}
+
+// ̺Ʈ   ̺Ʈ  ĳÿ ݿ
+void room_state_on_event(int kind, const char* room_number, const char* value) {
+    if (strlen(room_number) >= sizeof(((RoomState*)0)->room_number)) return;
+    pthread_rwlock_wrlock(&room_state_lock);
+    RoomState* st = room_state_find_or_add(room_number);
+    long long now = epoch_ms();
+    switch (kind) {
+    case BUS_CONNECTED:
+    case BUS_DISCONNECTED:
+        if (value && strcmp(value, "esp") == 0) {
+            st->esp_online = kind == BUS_CONNECTED;
+            if (!st->esp_online) st->door = "unknown";
+            else if (strcmp(st->door, "unknown") == 0) st->door = "locked";
+        }
+        else if (value && strcmp(value, "fr") == 0) {
+            st->fr_online = kind == BUS_CONNECTED;
+        }
+        break;
+    case BUS_DOOR_OPENED:
+        st->open_count++;
+        st->last_open_ms = now;
+        break;
+    case BUS_WRONG_PASSWORD:
+        st->wrong_password_count++;
+        break;
+    case BUS_INTRUDER:
+    case BUS_CAPTURED:
+        if (kind == BUS_INTRUDER) st->intruder_count++;
+        if (value) {
+            strncpy(st->last_image, value, IMAGE_HASH_LEN);
+            st->last_image[IMAGE_HASH_LEN] = '\0';
+        }
+        break;
+    }
+    st->last_event = kind;
+    st->last_event_ms = now;
+    pthread_rwlock_unlock(&room_state_lock);
+    persist_mark(room_number);
+}
+
+void room_state_set_door(const char* room_number, const char* door) {
+    if (strlen(room_number) >= sizeof(((RoomState*)0)->room_number)) return;
+    pthread_rwlock_wrlock(&room_state_lock);
+    room_state_find_or_add(room_number)->door = door;
+    pthread_rwlock_unlock(&room_state_lock);
+    persist_mark(room_number);
+}
+
+// DB    ȣؼ ĳ йȣ ؽ ü,   Ʈ ؽô  Ʈ(version  )
+int room_state_set_password(const char* room_number, const char* pw, uint32_t* version) {
+    char hash[IMAGE_HASH_LEN + 1];
+    char salt[CRED_SALT_LEN + 1];
+    char salted[IMAGE_HASH_LEN + 1];
+    if (strlen(room_number) >= sizeof(((RoomState*)0)->room_number) || sha256_hex(pw, strlen(pw), hash) < 0 ||
+        cred_new_salt(salt) < 0 || cred_salted_hash(salt, pw, salted) < 0) {
+        return -1;
+    }
+    pthread_rwlock_wrlock(&room_state_lock);
+    RoomState* st = room_state_find_or_add(room_number);
+    strcpy(st->pw_hash, hash);
+    strcpy(st->pw_salt, salt);
+    strcpy(st->pw_salted, salted);
+    st->pw_loaded = 1;
+    cred_log_add(st, CRED_OP_PW, NULL);
+    *version = st->cred_version;
+    pthread_rwlock_unlock(&room_state_lock);
+    persist_mark(room_number);
+    return 0;
+}
+
+// йȣ Ȯ(ĳÿ   DB ȸ), ġϸ 1
+int room_state_check_password(const char* room_number, const char* pw, MYSQL* conn) {
+    char hash[IMAGE_HASH_LEN + 1];
+    if (!room_state_get(room_number, conn) || sha256_hex(pw, strlen(pw), hash) < 0) {
+        return 0;
+    }
+    pthread_rwlock_rdlock(&room_state_lock);
+    RoomState* st = room_state_find(room_number);
+    int ok = st && st->pw_loaded && strcmp(st->pw_hash, hash) == 0;
+    pthread_rwlock_unlock(&room_state_lock);
+    return ok;
+}
+
+//   ȸ   : esp=<0|1>:fr=<0|1>:door=<>:opens=<>:last_open=<ms>:wrong_pw=<>:intruders=<>:last=<̺Ʈ>:last_ms=<ms>:locked=<  ms>:image=<ؽ>
+int room_state_format(const char* room_number, MYSQL* conn, char* out, size_t out_size) {
+    if (!room_state_get(room_number, conn)) {
+        return -1;
+    }
+    long long locked_ms = lockout_remaining_ms(room_number);
+    pthread_rwlock_rdlock(&room_state_lock);
+    RoomState* st = room_state_find(room_number);
+    snprintf(out, out_size, "esp=%d:fr=%d:door=%s:opens=%u:last_open=%lld:wrong_pw=%u:intruders=%u:last=%s:last_ms=%lld:locked=%lld:image=%s",
+        st->esp_online, st->fr_online, st->door, st->open_count, st->last_open_ms,
+        st->wrong_password_count, st->intruder_count,
+        st->last_event >= 0 ? bus_kind_name[st->last_event] : "none", st->last_event_ms, locked_ms, st->last_image);
+    pthread_rwlock_unlock(&room_state_lock);
+    return 0;
+}
+
+// ī ߰/  ٲ : 1 ٲ, 0 ̹  , -1   оų  
+int room_state_uid_change(const char* room_number, const char* uid, int add) {
+    int change = -1;
+    pthread_rwlock_rdlock(&room_state_lock);
+    RoomState* st = room_state_find(room_number);
+    if (st && st->uids_loaded) {
+        int found = cred_uid_index(st, uid) >= 0;
+        if (found == add) change = 0;
+        else if (!add || st->uid_count < CRED_MAX_UIDS) change = 1;
+    }
+    pthread_rwlock_unlock(&room_state_lock);
+    return change;
+}
+
+// DB    ȣؼ ĳ ī  , ٲ 0(version  )
+int room_state_set_uid(const char* room_number, const char* uid, int add, uint32_t* version) {
+    int changed = 0;
+    pthread_rwlock_wrlock(&room_state_lock);
+    RoomState* st = room_state_find(room_number);
+    if (st && st->uids_loaded) {
+        int i = cred_uid_index(st, uid);
+        if (add && i < 0 && st->uid_count < CRED_MAX_UIDS) {
+            strcpy(st->uids[st->uid_count++], uid);
+            changed = 1;
+        }
+        else if (!add && i >= 0) {
+            strcpy(st->uids[i], st->uids[--st->uid_count]); //  (ESP ؼ )
+            changed = 1;
+        }
+        if (changed) {
+            cred_log_add(st, add ? CRED_OP_UID_ADD : CRED_OP_UID_DEL, uid);
+            *version = st->cred_version;
+        }
+    }
+    pthread_rwlock_unlock(&room_state_lock);
+    if (!changed) return -1;
+    persist_mark(room_number);
+    return 0;
+}
+
+//  ī    : ver=<>:uids=<UID,UID,...|->
+int room_state_format_cards(const char* room_number, MYSQL* conn, char* out, size_t out_size) {
+    if (!room_state_get(room_number, conn)) {
+        return -1;
+    }
+    pthread_rwlock_rdlock(&room_state_lock);
+    RoomState* st = room_state_find(room_number);
+    int len = snprintf(out, out_size, "ver=%u:uids=%s", st->cred_version, st->uid_count ? "" : "-");
+    for (int i = 0; i < st->uid_count && len < (int)out_size; i++) {
+        len += snprintf(out + len, out_size - len, "%s%s", i ? "," : "", st->uids[i]);
+    }
+    pthread_rwlock_unlock(&room_state_lock);
+    return 0;
+}
+
+//  Ʈ(16Ʈ ) 16
+int cred_new_salt(char* out) {
+    unsigned char salt[CRED_SALT_LEN / 2];
+    if (RAND_bytes(salt, sizeof(salt)) != 1) {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(salt); i++) {
+        sprintf(out + i * 2, "%02x", salt[i]);
+    }
+    out[CRED_SALT_LEN] = '\0';
+    return 0;
+}
+
+//   йȣ ؽ : SHA-256(Ʈ 16 ڿ + йȣ), ESP   Է° Ȯ
+int cred_salted_hash(const char* salt, const char* pw, char* hex_out) {
+    char buf[CRED_SALT_LEN + BUF_SIZE];
+    int len = snprintf(buf, sizeof(buf), "%s%s", salt, pw);
+    if (len < 0 || len >= (int)sizeof(buf)) {
+        return -1;
+    }
+    int ret = sha256_hex(buf, len, hex_out);
+    memset(buf, 0, sizeof(buf)); //  ޸𸮿  
+    return ret;
+}
+
+// ī UID Ȯ : 4/7/10Ʈ 16, 빮ڷ ٲ㼭 out
+int cred_uid_normalize(const char* in, char* out) {
+    size_t len = strlen(in);
+    if (len != 8 && len != 14 && len != 20) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = in[i];
+        if (c >= 'a' && c <= 'f') c -= 'a' - 'A';
+        if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F'))) return -1;
+        out[i] = c;
+    }
+    out[len] = '\0';
+    return 0;
+}
+
+// room_state_lock  ¿ ȣ,  -1
+int cred_uid_index(const RoomState* st, const char* uid) {
+    for (int i = 0; i < st->uid_count; i++) {
+        if (strcmp(st->uids[i], uid) == 0) return i;
+    }
+    return -1;
+}
+
+//    ¿ ȣ :  ø  (CRED_LOG_MAX   )
+void cred_log_add(RoomState* st, int op, const char* uid) {
+    CredChange* ch = &st->cred_log[++st->cred_version % CRED_LOG_MAX];
+    ch->op = op;
+    snprintf(ch->uid, sizeof(ch->uid), "%s", uid ? uid : "");
+    if (st->cred_version - st->cred_log_base > CRED_LOG_MAX) {
+        st->cred_log_base = st->cred_version - CRED_LOG_MAX;
+    }
+}
+
+// since(ESP  )    ,  Ͽ  ü
+int cred_sync_commands(const char* room_number, uint32_t since, char (*cmds)[CRED_CMD_LEN], int max) {
+    int n = 0;
+    pthread_rwlock_rdlock(&room_state_lock);
+    RoomState* st = room_state_find(room_number);
+    if (st && since != st->cred_version) {
+        if (since >= st->cred_log_base && since < st->cred_version) {
+            for (uint32_t v = since + 1; v != st->cred_version + 1 && n < max; v++) {
+                CredChange* ch = &st->cred_log[v % CRED_LOG_MAX];
+                if (ch->op == CRED_OP_PW) {
+                    snprintf(cmds[n++], CRED_CMD_LEN, "pw_salt:%s:%s:%u", st->pw_salt, st->pw_salted, v);
+                }
+                else {
+                    snprintf(cmds[n++], CRED_CMD_LEN, "uid_%s:%s:%u", ch->op == CRED_OP_UID_ADD ? "add" : "del", ch->uid, v);
+                }
+            }
+        }
+        else {
+            // ó ,   ־,   : ī   ü, йȣ     ESP  
+            snprintf(cmds[n++], CRED_CMD_LEN, "cred_reset");
+            for (int i = 0; i < st->uid_count && n < max - 2; i++) {
+                snprintf(cmds[n++], CRED_CMD_LEN, "uid_add:%s:0", st->uids[i]);
+            }
+            if (st->pw_loaded && st->pw_salted[0]) {
+                snprintf(cmds[n++], CRED_CMD_LEN, "pw_salt:%s:%s:0", st->pw_salt, st->pw_salted);
+            }
+            snprintf(cmds[n++], CRED_CMD_LEN, "cred_ver:%u", st->cred_version);
+        }
+    }
+    pthread_rwlock_unlock(&room_state_lock);
+    return n;
+}
+
+//     (  sync,  йȣ/ī  ),  ACK Ȯ
+void cred_sync(const char* room_number, uint32_t since, MYSQL* conn) {
+    char cmds[CRED_MAX_UIDS + 3][CRED_CMD_LEN];
+    if (!room_state_get(room_number, conn)) return;
+    int n = cred_sync_commands(room_number, since, cmds, CRED_MAX_UIDS + 3);
+    RoomNode* node = room_node_hold(room_number); // ó (йȣ/ī ) θ
+    for (int i = 0; i < n && node; i++) {
+        if (send_room_command(node, cmds[i], NULL, NULL, NULL, NULL) == 0) {
+            break; //   : ٽ ϸ ESP  
+        }
+    }
+    room_node_release(node);
+    if (n > 0) printf("room %s credentials %u -> %d command(s).\n", room_number, since, n);
+}
+
+// ESP  ڵ      ĭ ħ,  Ʋų  Ⱓ  ڵ -1
+int telemetry_add(const char* room_number, const char* message) {
+    unsigned int ago, loops, loop_max_us, reconnects, conn_fails, keys, rfid_reads, opens, door_ms;
+    int rssi_avg, rssi_min;
+    if (strlen(room_number) >= sizeof(((RoomState*)0)->room_number) ||
+        sscanf(message, "ESP32:room_%*[^:]:telemetry:%u:%u:%u:%d:%d:%u:%u:%u:%u:%u:%u", &ago, &loops, &loop_max_us,
+            &rssi_avg, &rssi_min, &reconnects, &conn_fails, &keys, &rfid_reads, &opens, &door_ms) != 11 ||
+        ago >= TELEMETRY_SLOTS * 60) {
+        return -1;
+    }
+    long long minute = (epoch_ms() / 1000 - ago) / 60;
+    pthread_rwlock_wrlock(&room_state_lock);
+    RoomState* st = room_state_find_or_add(room_number);
+    if (!st->telemetry) {
+        st->telemetry = (TelemetrySlot*)calloc(TELEMETRY_SLOTS, sizeof(TelemetrySlot));
+    }
+    TelemetrySlot* t = &st->telemetry[minute % TELEMETRY_SLOTS];
+    if (t->minute != minute) {
+        memset(t, 0, sizeof(*t)); //  ð  ĭ
+        t->minute = minute;
+    }
+    t->records++;
+    t->loops += loops;
+    if (loop_max_us > t->loop_max_us) t->loop_max_us = loop_max_us;
+    if (rssi_avg < 0) {
+        t->rssi_sum += rssi_avg;
+        t->rssi_count++;
+    }
+    if (rssi_min < 0 && (t->rssi_min == 0 || rssi_min < t->rssi_min)) t->rssi_min = rssi_min;
+    t->reconnects += reconnects;
+    t->conn_fails += conn_fails;
+    t->keys += keys;
+    t->rfid_reads += rfid_reads;
+    t->opens += opens;
+    if (door_ms > t->door_max_ms) t->door_max_ms = door_ms;
+    pthread_rwlock_unlock(&room_state_lock);
+    return 0;
+}
+
+//   (Ǵ recv 迡 ߸  պκ)
+int telemetry_partial(const char* room_number, const char* line, int line_len) {
+    char prefix[BUF_SIZE];
+    int len = snprintf(prefix, sizeof(prefix), "ESP32:room_%s:telemetry:", room_number);
+    return strncmp(line, prefix, line_len < len ? line_len : len) == 0;
+}
+
+// room_state_lock  ¿ ȣ : since_minute  ĭ (sum->minute  ִ  )
+void telemetry_sum(const RoomState* st, long long since_minute, TelemetrySlot* sum) {
+    memset(sum, 0, sizeof(*sum));
+    for (int i = 0; st->telemetry && i < TELEMETRY_SLOTS; i++) {
+        const TelemetrySlot* t = &st->telemetry[i];
+        if (t->records == 0 || t->minute < since_minute) continue;
+        sum->minute++;
+        sum->records += t->records;
+        sum->loops += t->loops;
+        if (t->loop_max_us > sum->loop_max_us) sum->loop_max_us = t->loop_max_us;
+        sum->rssi_sum += t->rssi_sum;
+        sum->rssi_count += t->rssi_count;
+        if (t->rssi_min < 0 && (sum->rssi_min == 0 || t->rssi_min < sum->rssi_min)) sum->rssi_min = t->rssi_min;
+        sum->reconnects += t->reconnects;
+        sum->conn_fails += t->conn_fails;
+        sum->keys += t->keys;
+        sum->rfid_reads += t->rfid_reads;
+        sum->opens += t->opens;
+        if (t->door_max_ms > sum->door_max_ms) sum->door_max_ms = t->door_max_ms;
+    }
+}
+
+//    : ֱ minutes հ records=..:rssi_avg=..:rssi_min=..:reconnects=..:conn_fails=..:loops=..:loop_max_us=..:keys=..:rfid=..:opens=..:door_max_ms=..
+// ڿ к series=<  >/<RSSI >/<+ >/<loop ִ  us>,... ( ִ и, ֱ ),   -1
+int telemetry_format_room(const char* room_number, int minutes, char* out, size_t out_size) {
+    if (minutes <= 0 || minutes > TELEMETRY_SLOTS) minutes = TELEMETRY_SLOTS;
+    long long now_minute = epoch_ms() / 60000;
+    int ret = -1;
+    pthread_rwlock_rdlock(&room_state_lock);
+    RoomState* st = room_state_find(room_number);
+    if (st && st->telemetry) {
+        TelemetrySlot sum;
+        telemetry_sum(st, now_minute - minutes + 1, &sum);
+        if (sum.records > 0) {
+            int len = snprintf(out, out_size, "records=%u:rssi_avg=%d:rssi_min=%d:reconnects=%u:conn_fails=%u:loops=%u:loop_max_us=%u:keys=%u:rfid=%u:opens=%u:door_max_ms=%u:series=",
+                sum.records, sum.rssi_count ? sum.rssi_sum / (int)sum.rssi_count : 0, sum.rssi_min, sum.reconnects, sum.conn_fails,
+                sum.loops, sum.loop_max_us, sum.keys, sum.rfid_reads, sum.opens, sum.door_max_ms);
+            int first = 1;
+            for (int ago = 0; ago < minutes && len < (int)out_size; ago++) {
+                const TelemetrySlot* t = &st->telemetry[(now_minute - ago) % TELEMETRY_SLOTS];
+                if (t->records == 0 || t->minute != now_minute - ago) continue;
+                len += snprintf(out + len, out_size - len, "%s%d/%d/%u/%u", first ? "" : ",", ago,
+                    t->rssi_count ? t->rssi_sum / (int)t->rssi_count : 0, t->reconnects + t->conn_fails, t->loop_max_us);
+                first = 0;
+            }
+            ret = 0;
+        }
+    }
+    pthread_rwlock_unlock(&room_state_lock);
+    return ret;
+}
+
+// ֱ TELEMETRY_SLOTS     TELEMETRY_WORST : + а  ,  RSSI   
+// <>=<RSSI >/<>/< >/< պ  ms>:... (      պ  )
+int telemetry_format_worst(char* out, size_t out_size) {
+    struct {
+        char room_number[10];
+        int rssi;
+        unsigned int reconnects;
+        unsigned int conn_fails;
+    } worst[TELEMETRY_WORST];
+    int count = 0;
+    long long since = epoch_ms() / 60000 - TELEMETRY_SLOTS + 1;
+
+    pthread_rwlock_rdlock(&room_state_lock);
+    for (int b = 0; b < ROOM_STATE_BUCKETS; b++) {
+        for (RoomState* st = room_states[b]; st; st = st->next) {
+            if (!st->telemetry) continue;
+            TelemetrySlot sum;
+            telemetry_sum(st, since, &sum);
+            if (sum.records == 0) continue;
+            int rssi = sum.rssi_count ? sum.rssi_sum / (int)sum.rssi_count : 0;
+            unsigned int drops = sum.reconnects + sum.conn_fails;
+            //  ڸ ã( )
+            int pos = count;
+            while (pos > 0 && (worst[pos - 1].reconnects + worst[pos - 1].conn_fails < drops ||
+                (worst[pos - 1].reconnects + worst[pos - 1].conn_fails == drops && worst[pos - 1].rssi > rssi))) {
+                pos--;
+            }
+            if (pos >= TELEMETRY_WORST) continue;
+            if (count < TELEMETRY_WORST) count++;
+            memmove(&worst[pos + 1], &worst[pos], (count - pos - 1) * sizeof(worst[0]));
+            strcpy(worst[pos].room_number, st->room_number);
+            worst[pos].rssi = rssi;
+            worst[pos].reconnects = sum.reconnects;
+            worst[pos].conn_fails = sum.conn_fails;
+        }
+    }
+    pthread_rwlock_unlock(&room_state_lock);
+
+    int len = snprintf(out, out_size, "%s", count ? "" : "none");
+    for (int i = 0; i < count && len < (int)out_size; i++) {
+        double rtt = 0;
+        RoomNode* node = room_node_hold(worst[i].room_number);
+        if (node) {
+            pthread_mutex_lock(&node->lock);
+            rtt = node->cmd_rtt_avg_ms;
+            pthread_mutex_unlock(&node->lock);
+            room_node_release(node);
+        }
+        len += snprintf(out + len, out_size - len, "%s%s=%d/%u/%u/%.0f", i ? ":" : "", worst[i].room_number,
+            worst[i].rssi, worst[i].reconnects, worst[i].conn_fails, rtt);
+    }
+    return count;
+}
+
+//  ȣ  ī ڸ ã(create   CAS  ڸ ), ڸ  NULL
+AttemptSlot* attempt_slot(const char* room_number, int create) {
+    uint64_t key = 14695981039346656037ull; // FNV-1a 64
+    for (const char* c = room_number; *c; c++) {
+        key = (key ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    if (key == 0) key = 1;
+    for (unsigned int i = 0; i < LOCKOUT_SLOTS; i++) {
+        AttemptSlot* slot = &attempt_slots[(key + i) & (LOCKOUT_SLOTS - 1)];
+        uint64_t cur = atomic_load(&slot->key);
+        if (cur == key) return slot;
+        if (cur == 0) {
+            if (!create) return NULL;
+            uint64_t expected = 0;
+            if (atomic_compare_exchange_strong(&slot->key, &expected, key) || expected == key) {
+                return slot;
+            }
+        }
+    }
+    return NULL;
+}
+
+//  õ  : и  ĭ ø  հ  Ǵ, ̸     
+//  ᰡ ϸ  ð(ms), ƴϸ 0 ȯ
+long long record_attempt(const char* room_number, int cred, int ok) {
+    AttemptSlot* slot = attempt_slot(room_number, 1);
+    if (!slot) return 0;
+    long long now = now_ms();
+    uint64_t epoch = (uint64_t)(now / (LOCKOUT_WINDOW_MS / LOCKOUT_BUCKETS));
+
+    if (ok) {
+        for (int b = 0; b < LOCKOUT_BUCKETS; b++) atomic_store(&slot->buckets[cred][b], 0);
+        return 0;
+    }
+
+    _Atomic uint64_t* bucket = &slot->buckets[cred][epoch % LOCKOUT_BUCKETS];
+    uint64_t old = atomic_load(bucket);
+    uint64_t next;
+    do {
+        next = (old >> 20) == epoch ? old + 1 : (epoch << 20) | 1;
+    } while (!atomic_compare_exchange_weak(bucket, &old, next));
+
+    int total = 0;
+    int cred_fails = 0;
+    for (int c = 0; c < CRED_COUNT; c++) {
+        int sum = 0;
+        for (int b = 0; b < LOCKOUT_BUCKETS; b++) {
+            uint64_t v = atomic_load(&slot->buckets[c][b]);
+            if (epoch - (v >> 20) < LOCKOUT_BUCKETS) sum += (int)(v & 0xFFFFF);
+        }
+        if (c == cred) cred_fails = sum;
+        total += sum;
+    }
+    if (cred_fails < LOCKOUT_MAX_FAILS && total < LOCKOUT_MAX_TOTAL) {
+        return 0;
+    }
+
+    // ̹  ¸ ٽ ˸ , ÿ  尡 Ѱܵ CAS   
+    long long until = atomic_load(&slot->locked_until_ms);
+    if (until > now) return 0;
+    if (!atomic_compare_exchange_strong(&slot->locked_until_ms, &until, now + LOCKOUT_MS)) return 0;
+    atomic_fetch_add(&slot->lockouts, 1);
+    for (int c = 0; c < CRED_COUNT; c++) {
+        for (int b = 0; b < LOCKOUT_BUCKETS; b++) atomic_store(&slot->buckets[c][b], 0);
+    }
+    return LOCKOUT_MS;
+}
+
+long long lockout_remaining_ms(const char* room_number) {
+    AttemptSlot* slot = attempt_slot(room_number, 0);
+    if (!slot) return 0;
+    long long left = atomic_load(&slot->locked_until_ms) - now_ms();
+    return left > 0 ? left : 0;
+}
+
+//   :   (Űе/RFID Ȱȭ), FR ĸó û, ̺Ʈ 
+void begin_lockout(RoomNode* node, long long lock_ms, const char* reason) {
+    AttemptSlot* slot = attempt_slot(node->room_number, 1);
+    if (slot) {
+        //  ߿ wrong_password   ٷ 
+        long long until = now_ms() + lock_ms;
+        if (atomic_load(&slot->locked_until_ms) < until) atomic_store(&slot->locked_until_ms, until);
+    }
+    printf("room %s locked out %lld s (%s).\n", node->room_number, lock_ms / 1000, reason);
+
+    char command[BUF_SIZE];
+    char seconds[24];
+    snprintf(seconds, sizeof(seconds), "%lld", lock_ms / 1000);
+    snprintf(command, sizeof(command), "lockout:%s", seconds);
+    send_room_command(node, command, NULL, NULL, NULL, NULL);
+    bus_publish(BUS_WRONG_PASSWORD, node->room_number, NULL);
+    bus_publish(BUS_LOCKED_OUT, node->room_number, seconds);
+    session_stop(node, "lockout"); //  ߿ ν ص  
+
+    // 峭 Űе峪   ĸó û  
+    if (!allow_room_event(node, EVENT_CAPTURE_REQUEST)) {
+        return;
+    }
+    printf("ESP32: room %s fail password. FR capture request...\n", node->room_number);
+    char capture_request_msg[BUF_SIZE];
+    snprintf(capture_request_msg, sizeof(capture_request_msg), "FR:room_%s:request_capture\n", node->room_number);
+    if (room_send(node, TARGET_FR, capture_request_msg) < 0) {
+        printf("Not found room %s.\n", node->room_number);
+    }
+}
+
+// ν   :  ID, FR  0,  ̸ -1
+//  ̸  ID  ð ø,  þ (Űе Ÿ ) FR ٽ  
+int session_open(RoomNode* node, int seconds, const char* reason) {
+    if (lockout_remaining_ms(node->room_number) > 0) return -1;
+    if (seconds <= 0 || seconds > SESSION_MAX_SECONDS) seconds = SESSION_SECONDS;
+
+    char msg[BUF_SIZE];
+    long long now = now_ms();
+    int send = 0;
+    pthread_mutex_lock(&node->lock);
+    if (node->fr_sock <= 0) {
+        pthread_mutex_unlock(&node->lock);
+        return 0;
+    }
+    int fresh = node->session_id == 0 || now >= node->session_until_ms;
+    if (fresh) {
+        static _Atomic unsigned int next_session_id = 1; // 渶 ٸ  Ʒ øǷ 
+        do {
+            node->session_id = atomic_fetch_add(&next_session_id, 1);
+        } while (node->session_id == 0);
+        node->session_start_ms = now;
+        node->sessions++;
+    }
+    long long until = now + seconds * 1000LL;
+    if (until > node->session_start_ms + SESSION_MAX_SECONDS * 1000LL) until = node->session_start_ms + SESSION_MAX_SECONDS * 1000LL;
+    if (until > node->session_until_ms || fresh) node->session_until_ms = until;
+    if (fresh || node->session_until_ms - node->session_sent_until_ms >= SESSION_RESEND_MS) {
+        node->session_sent_until_ms = node->session_until_ms;
+        int left = (int)((node->session_until_ms - now + 999) / 1000);
+        snprintf(msg, sizeof(msg), "FR:room_%s:session_start:%u:%d\n", node->room_number, node->session_id, left);
+        send = 1;
+    }
+    int id = (int)node->session_id;
+    pthread_mutex_unlock(&node->lock);
+
+    if (send) {
+        printf("room %s session %d %s (%s).\n", node->room_number, id, fresh ? "open" : "extend", reason);
+        room_send(node, TARGET_FR, msg);
+    }
+    return id;
+}
+
+// FR  (, ð ʰ), ̹    
+void session_close(RoomNode* node, unsigned int id, const char* result) {
+    pthread_mutex_lock(&node->lock);
+    int current = id != 0 && node->session_id == id;
+    if (current) {
+        node->session_id = 0;
+        node->session_until_ms = 0;
+    }
+    pthread_mutex_unlock(&node->lock);
+    printf("room %s session %u end %s%s.\n", node->room_number, id, result, current ? "" : " (stale)");
+}
+
+//     ʿ  :   ID,  0
+unsigned int session_stop(RoomNode* node, const char* reason) {
+    char msg[BUF_SIZE];
+    pthread_mutex_lock(&node->lock);
+    unsigned int id = node->session_id;
+    if (id != 0 && now_ms() >= node->session_until_ms) id = 0; // ̹  
+    node->session_id = 0;
+    node->session_until_ms = 0;
+    pthread_mutex_unlock(&node->lock);
+    if (id == 0) return 0;
+
+    printf("room %s session %u stop (%s).\n", node->room_number, id, reason);
+    snprintf(msg, sizeof(msg), "FR:room_%s:session_stop:%u\n", node->room_number, id);
+    room_send(node, TARGET_FR, msg);
+    return id;
+}
+
+// ڿ ؽ(FNV-1a ڿ Ʈ ),  ġ  
+uint64_t hash64(const char* str) {
+    uint64_t h = 14695981039346656037ull;
+    for (const char* c = str; *c; c++) {
+        h = (h ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+int ring_point_cmp(const void* a, const void* b) {
+    uint64_t x = ((const RingPoint*)a)->hash;
+    uint64_t y = ((const RingPoint*)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+//    ؽ   : argv[2] ڱ ּ, argv[3..] ٸ  ּ
+int cluster_init(int argc, char* argv[]) {
+    cluster_count = argc > 2 ? argc - 2 : 1;
+    if (cluster_count > MAX_CLUSTER_NODES) {
+        return -1;
+    }
+    self_node = 0;
+    for (int n = 0; n < cluster_count; n++) {
+        ClusterNode* node = &cluster_nodes[n];
+        char host[sizeof(node->host)] = "localhost";
+        int port = argc > 1 ? atoi(argv[1]) : PORT;
+        if (argc > 2 && sscanf(argv[n + 2], "%63[^:]:%d", host, &port) != 2) {
+            return -1;
+        }
+        node->sock = -1;
+        pthread_mutex_init(&node->lock, NULL);
+        strcpy(node->host, host);
+        node->port = port;
+        snprintf(node->addr, sizeof(node->addr), "%.63s:%d", host, port); //  ڽ host ġ ʰ 纻
+
+    }
+
+    ring_size = 0;
+    for (int n = 0; n < cluster_count; n++) {
+        for (int v = 0; v < RING_VNODES; v++) {
+            char key[BUF_SIZE];
+            snprintf(key, sizeof(key), "%s#%d", cluster_nodes[n].addr, v);
+            ring[ring_size].hash = hash64(key);
+            ring[ring_size].node = n;
+            ring_size++;
+        }
+    }
+    qsort(ring, ring_size, sizeof(RingPoint), ring_point_cmp);
+    return 0;
+}
+
+//    :  ȣ ؽú ũų  ù  ġ( ó ư)
+int owner_node(const char* room_number) {
+    if (cluster_count <= 1) return self_node;
+    uint64_t h = hash64(room_number);
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    return ring[lo == ring_size ? 0 : lo].node;
+}
+
+// ٸ   ̸   ּҸ ˷ְ 1 ȯ( ȣ ʿ )
+int redirect_if_remote(int client_sock, const char* room_number) {
+    int owner = owner_node(room_number);
+    if (owner == self_node) return 0;
+    char msg[BUF_SIZE];
+    snprintf(msg, sizeof(msg), "REDIRECT:%s:%d\n", cluster_nodes[owner].host, cluster_nodes[owner].port);
+    web_write_all(client_sock, msg, strlen(msg));
+    printf("room %s redirect to %s.\n", room_number, cluster_nodes[owner].addr);
+    return 1;
+}
+
+//  ޿ (node->lock  ¿ ȣ), ó   ϰ  б  
+int peer_connect(int n) {
+    ClusterNode* node = &cluster_nodes[n];
+    if (node->sock >= 0) return 0;
+
+    struct addrinfo hints = { 0 };
+    struct addrinfo* res = NULL;
+    char port_str[16];
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port_str, sizeof(port_str), "%d", node->port);
+    if (getaddrinfo(node->host, port_str, &hints, &res) != 0) {
+        return -1;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, res->ai_addr, res->ai_addrlen) < 0 || web_write_all(sock, "WEB:peer\n", 9) < 0) {
+        if (sock >= 0) close(sock);
+        freeaddrinfo(res);
+        printf("cluster node %s connect fail.\n", node->addr);
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    int* arg = (int*)malloc(sizeof(int) * 2);
+    arg[0] = n;
+    arg[1] = sock;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, peer_reader_thread, arg) != 0) {
+        free(arg);
+        close(sock);
+        return -1;
+    }
+    pthread_detach(tid);
+    node->sock = sock;
+    printf("cluster node %s connect.\n", node->addr);
+    return 0;
+}
+
+// WEB û    : "@f<ID> <û>\n",  и 0 ȯ(web  offline  )
+unsigned int forward_send(int n, const char* line, WebConn* web, const char* tag, const char* room_number, const char* status) {
+    pthread_mutex_lock(&forward_mutex);
+    unsigned int id = next_forward_id++;
+    if (next_forward_id == 0) next_forward_id = 1;
+    ForwardRequest* f = &forwards[id % MAX_FORWARDS];
+    if (f->id != 0) {
+        pthread_mutex_unlock(&forward_mutex);
+        if (web) {
+            char reply[BUF_SIZE];
+            snprintf(reply, sizeof(reply), "WEB:room_%s:%s:offline\n", room_number, status);
+            web_reply(web, tag, reply);
+        }
+        return 0;
+    }
+    memset(f, 0, sizeof(*f));
+    f->id = id;
+    f->node = n;
+    f->web = web;
+    if (web) web_conn_hold(web);
+    strncpy(f->tag, tag ? tag : "", sizeof(f->tag) - 1);
+    strncpy(f->room_number, room_number, sizeof(f->room_number) - 1);
+    strncpy(f->status, status, sizeof(f->status) - 1);
+    f->sent_ms = now_ms();
+    pthread_mutex_unlock(&forward_mutex);
+
+    size_t msg_size = strlen(line) + 16;
+    char* msg = (char*)malloc(msg_size);
+    int len = snprintf(msg, msg_size, "@f%u %s\n", id, line);
+    ClusterNode* node = &cluster_nodes[n];
+    pthread_mutex_lock(&node->lock);
+    int result = peer_connect(n);
+    if (result == 0 && web_write_all(node->sock, msg, len) < 0) {
+        shutdown(node->sock, SHUT_RDWR); // б 尡 
+        result = -1;
+    }
+    pthread_mutex_unlock(&node->lock);
+    free(msg);
+
+    if (result < 0) {
+        forward_finish(id, NULL);
+        return 0;
+    }
+    return id;
+}
+
+//  û Ϸ(reply NULL̸ ) :  ̸ ٷ , ƴϸ ٸ 带 
+void forward_finish(unsigned int id, const char* reply) {
+    if (id == 0) return;
+    pthread_mutex_lock(&forward_mutex);
+    ForwardRequest* f = &forwards[id % MAX_FORWARDS];
+    if (f->id != id || f->done) {
+        pthread_mutex_unlock(&forward_mutex);
+        return;
+    }
+    if (!f->web) {
+        f->reply = reply ? strdup(reply) : NULL;
+        f->done = 1;
+        pthread_cond_broadcast(&forward_done);
+        pthread_mutex_unlock(&forward_mutex);
+        return;
+    }
+    ForwardRequest done = *f;
+    f->id = 0;
+    pthread_mutex_unlock(&forward_mutex);
+
+    if (reply) {
+        size_t size = strlen(reply) + 2;
+        char* line = (char*)malloc(size);
+        snprintf(line, size, "%s\n", reply);
+        web_reply(done.web, done.tag, line);
+        free(line);
+    }
+    else {
+        char line[BUF_SIZE];
+        snprintf(line, sizeof(line), "WEB:room_%s:%s:offline\n", done.room_number, done.status);
+        web_reply(done.web, done.tag, line);
+    }
+    web_conn_release(done.web);
+}
+
+// forward_send(web )  ٸ,  ڿ(free ʿ) Ǵ /ð ʰ NULL
+char* forward_wait(unsigned int id, long long timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&forward_mutex);
+    ForwardRequest* f = &forwards[id % MAX_FORWARDS];
+    while (f->id == id && !f->done) {
+        if (pthread_cond_timedwait(&forward_done, &forward_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    char* reply = NULL;
+    if (f->id == id) {
+        reply = f->reply;
+        f->id = 0;
+    }
+    pthread_mutex_unlock(&forward_mutex);
+    return reply;
+}
+
+// ٸ 忡   б : "@f<ID> <>" ٷ  û Ϸ,      û  
+void* peer_reader_thread(void* arg) {
+    int n = ((int*)arg)[0];
+    int sock = ((int*)arg)[1];
+    free(arg);
+
+    char buffer[RECV_BUF_SIZE];
+    int used = 0;
+    while (1) {
+        int received = recv(sock, buffer + used, sizeof(buffer) - 1 - used, 0);
+        if (received <= 0) break;
+        used += received;
+        buffer[used] = '\0';
+
+        char* line = buffer;
+        char* newline;
+        while ((newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+            unsigned int id = 0;
+            int skip = 0;
+            if (sscanf(line, "@f%u %n", &id, &skip) == 1 && skip > 0) {
+                forward_finish(id, line + skip);
+            }
+            line = newline + 1;
+        }
+        used -= (int)(line - buffer);
+        memmove(buffer, line, used);
+        if (used == (int)sizeof(buffer) - 1) used = 0; // ʹ   
+    }
+
+    ClusterNode* node = &cluster_nodes[n];
+    pthread_mutex_lock(&node->lock);
+    if (node->sock == sock) node->sock = -1;
+    pthread_mutex_unlock(&node->lock);
+    close(sock);
+    printf("cluster node %s disconnect.\n", node->addr);
+
+    for (int i = 0; i < MAX_FORWARDS; i++) {
+        pthread_mutex_lock(&forward_mutex);
+        unsigned int id = forwards[i].id;
+        int mine = id != 0 && forwards[i].node == n && !forwards[i].done;
+        pthread_mutex_unlock(&forward_mutex);
+        if (mine) forward_finish(id, NULL);
+    }
+    return NULL;
+}
+
+// SIGUSR1 : ƹ͵  ,  ִ recv EINTR ƿ ϴ 뵵
+void wake_signal(int sig) {
+}
+
+// λ縻 ó  Ŭ̾Ʈ Ͽ 
+ClientConn* client_register(int sock, int type, const char* hello) {
+    ClientConn* client = (ClientConn*)slab_alloc(&client_conn_slab);
+    client->parked = 0;
+    client->hello[0] = '\0';
+    client->tid = pthread_self();
+    client->sock = sock;
+    client->type = type;
+    strncat(client->hello, hello, sizeof(client->hello) - 1);
+    pthread_mutex_lock(&client_mutex);
+    client->next = client_conns;
+    client_conns = client;
+    pthread_mutex_unlock(&client_mutex);
+    return client;
+}
+
+void client_unregister(ClientConn* client) {
+    if (!client) return;
+    pthread_mutex_lock(&client_mutex);
+    ClientConn** pp = &client_conns;
+    while (*pp && *pp != client) pp = &(*pp)->next;
+    if (*pp) *pp = client->next;
+    pthread_mutex_unlock(&client_mutex);
+    slab_free(&client_conn_slab, client);
+}
+
+//  ܰ迡   б 尡  ϴ :  , ESP/FR/SUB ó    
+int handoff_should_park(int client_type) {
+    int phase = atomic_load(&handoff_phase);
+    if (client_type == 0 || phase == 0) return 0;
+    return phase >= (client_type == CLIENT_TYPE_WEB ? HANDOFF_PHASE_WEB : HANDOFF_PHASE_ALL);
+}
+
+//  ܰ踦 ø ش б 尡    ,    ȯ
+int park_clients(int phase) {
+    atomic_store(&handoff_phase, phase);
+    long long deadline = now_ms() + HANDOFF_PARK_MS;
+    while (1) {
+        int waiting = 0;
+        pthread_mutex_lock(&client_mutex);
+        for (ClientConn* c = client_conns; c; c = c->next) {
+            if (!c->parked && handoff_should_park(c->type)) {
+                waiting++;
+                if (io_backend == IO_BACKEND_THREADS) {
+                    pthread_kill(c->tid, SIGUSR1); // recv     Ƿ   ݺ
+                }
+            }
+        }
+        pthread_mutex_unlock(&client_mutex);
+        if (io_backend != IO_BACKEND_THREADS) {
+            io_wake(); // I/O 尡 б⸦ ߰ ۾ 忡 ѱ غ Ŵ
+        }
+        if (waiting == 0 || now_ms() > deadline) return waiting;
+        usleep(20000);
+    }
+}
+
+//  ٸ ESP ,  , ٸ      ٸ(ִ FORWARD_TIMEOUT_MS)
+void drain_commands(void) {
+    long long deadline = now_ms() + FORWARD_TIMEOUT_MS;
+    while (now_ms() < deadline) {
+        int busy = 0;
+        pthread_mutex_lock(&pending_mutex);
+        for (int i = 0; i < MAX_PENDING_COMMANDS && !busy; i++) busy = pending_commands[i].id != 0;
+        pthread_mutex_unlock(&pending_mutex);
+        pthread_mutex_lock(&web_conn_mutex);
+        for (WebConn* web = web_conns; web && !busy; web = web->next) busy = web->inflight > 0;
+        pthread_mutex_unlock(&web_conn_mutex);
+        pthread_mutex_lock(&forward_mutex);
+        for (int i = 0; i < MAX_FORWARDS && !busy; i++) busy = forwards[i].id != 0;
+        pthread_mutex_unlock(&forward_mutex);
+        if (!busy) return;
+        usleep(20000);
+    }
+    printf("handoff : commands still pending, continue.\n");
+}
+
+// ڵ ϳ , fd >= 0 ̸  ѱ(SCM_RIGHTS)
+int handoff_send_rec(int h, const char* rec, int fd) {
+    struct iovec iov = { (void*)rec, strlen(rec) + 1 };
+    struct msghdr msg = { 0 };
+    char control[CMSG_SPACE(sizeof(int))];
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(h, &msg, MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+// ڵ ϳ ޱ,   fd *fd( -1)
+int handoff_recv_rec(int h, char* rec, int* fd) {
+    struct iovec iov = { rec, HANDOFF_REC_LEN };
+    struct msghdr msg = { 0 };
+    char control[CMSG_SPACE(sizeof(int))];
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    *fd = -1;
+    ssize_t n = recvmsg(h, &msg, 0);
+    if (n <= 0) return -1;
+    rec[n < HANDOFF_REC_LEN ? n : HANDOFF_REC_LEN - 1] = '\0';
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return 0;
+}
+
+//    н , ص   (۸ Ұ)
+int handoff_listen(int port) {
+    struct sockaddr_un addr = { 0 };
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), HANDOFF_PATH_FMT, port);
+    int h = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (h < 0) return -1;
+    unlink(addr.sun_path); //    (Ѱܹ 쿡     )
+    if (bind(h, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(h, 1) < 0) {
+        perror("handoff socket fail");
+        close(h);
+        return -1;
+    }
+    return h;
+}
+
+//    : б⸦ ܰ躰 ߰  , Ŭ̾Ʈ ,  ¸ ѱ
+// û ߸Ǿ 1( ), ѱ    Ȯϸ 0, ѱ  ϸ -1
+int handoff_send(int h, int server_sock) {
+    char rec[HANDOFF_REC_LEN];
+    int fd;
+    if (handoff_recv_rec(h, rec, &fd) < 0 || strcmp(rec, "takeover") != 0) {
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    printf("handoff : new server takeover start.\n");
+
+    // 1ܰ :  û   ʰ ó   (ESP ACK  )
+    park_clients(HANDOFF_PHASE_WEB);
+    drain_commands();
+    // 2ܰ :  б ,  ť    (   λ縻 ٽ )
+    int stuck = park_clients(HANDOFF_PHASE_ALL);
+    if (stuck > 0) {
+        printf("handoff : %d clients not parked, they will reconnect.\n", stuck);
+    }
+    dispatch_drain(); // ť  ̹ (̺Ʈ  )   ߱  
+    bus_pause();
+
+    if (handoff_send_rec(h, "listen", server_sock) < 0) return -1;
+    int count = 0;
+    pthread_mutex_lock(&client_mutex);
+    for (ClientConn* c = client_conns; c; c = c->next) {
+        if (!c->parked) continue;
+        snprintf(rec, sizeof(rec), "client:%s", c->hello);
+        if (handoff_send_rec(h, rec, c->sock) < 0) {
+            pthread_mutex_unlock(&client_mutex);
+            return -1;
+        }
+        count++;
+    }
+    pthread_mutex_unlock(&client_mutex);
+
+    //   : ̺Ʈ Ѱ  պ ð (now_ms ý   ð ״ ѱ)
+    //  ڵ嵵 ϳ    :    Ϻ  ̾ ʵ end  
+    int ok = 1;
+    pthread_mutex_lock(&room_table_mutex);
+    for (RoomNode* node = room_table; node && ok; node = node->next) {
+        snprintf(rec, sizeof(rec), "room:%s:%f:%lld:%lld:%lld:%lld:%u:%lld:%f:%lld:%u:%u:%u",
+            node->room_number, node->event_tokens, node->token_refill_ms,
+            node->last_event_ms[0], node->last_event_ms[1], node->last_event_ms[2], node->dropped_events,
+            node->cmd_rtt_last_ms, node->cmd_rtt_avg_ms, node->cmd_rtt_max_ms,
+            node->cmd_acked, node->cmd_nacked, node->cmd_timeouts);
+        ok = handoff_send_rec(h, rec, -1) == 0;
+    }
+    pthread_mutex_unlock(&room_table_mutex);
+
+    //   ĳÿ   ī
+    pthread_rwlock_rdlock(&room_state_lock);
+    for (int b = 0; b < ROOM_STATE_BUCKETS && ok; b++) {
+        for (RoomState* st = room_states[b]; st && ok; st = st->next) {
+            snprintf(rec, sizeof(rec), "state:%s:%s:%d:%d:%s:%lld:%u:%u:%u:%d:%lld:%s",
+                st->room_number, st->pw_loaded ? st->pw_hash : "-", st->esp_online, st->fr_online, st->door,
+                st->last_open_ms, st->open_count, st->wrong_password_count, st->intruder_count,
+                st->last_event, st->last_event_ms, st->last_image[0] ? st->last_image : "-");
+            if (handoff_send_rec(h, rec, -1) < 0) {
+                ok = 0;
+                break;
+            }
+
+            //    :  ƾ   ESP 游   (  ѱ )
+            int len = snprintf(rec, sizeof(rec), "cred:%s:%u:%s:%s:%d:", st->room_number, st->cred_version,
+                st->pw_salt[0] ? st->pw_salt : "-", st->pw_salted[0] ? st->pw_salted : "-", st->uids_loaded);
+            for (int i = 0; i < st->uid_count; i++) {
+                len += snprintf(rec + len, sizeof(rec) - len, "%s%s", i ? "," : "", st->uids[i]);
+            }
+            if (st->uid_count == 0) snprintf(rec + len, sizeof(rec) - len, "-");
+            if (handoff_send_rec(h, rec, -1) < 0) {
+                ok = 0;
+                break;
+            }
+
+            AttemptSlot* slot = attempt_slot(st->room_number, 0);
+            if (!slot) continue;
+            len = snprintf(rec, sizeof(rec), "lock:%s:%lld:%u", st->room_number,
+                (long long)atomic_load(&slot->locked_until_ms), atomic_load(&slot->lockouts));
+            for (int c = 0; c < CRED_COUNT; c++) {
+                for (int i = 0; i < LOCKOUT_BUCKETS; i++) {
+                    len += snprintf(rec + len, sizeof(rec) - len, ":%llu", (unsigned long long)atomic_load(&slot->buckets[c][i]));
+                }
+            }
+            ok = handoff_send_rec(h, rec, -1) == 0;
+        }
+    }
+    pthread_rwlock_unlock(&room_state_lock);
+
+    if (!ok || handoff_send_rec(h, "end", -1) < 0) return -1;
+    struct timeval tv = { 10, 0 };
+    setsockopt(h, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (handoff_recv_rec(h, rec, &fd) < 0 || strcmp(rec, "ok") != 0) {
+        return -1;
+    }
+    printf("handoff : %d clients passed.\n", count);
+    return 0;
+}
+
+// ѱ (  Ȯ ) :  б  , accept ٽ 
+// ѱ     纻    ״ζ Ŭ̾Ʈ ٽ  
+void handoff_abort(void) {
+    atomic_store(&handoff_phase, 0);
+    int count = 0;
+    pthread_mutex_lock(&client_mutex);
+    for (ClientConn* c = client_conns; c; c = c->next) {
+        if (c->parked) count++;
+        c->parked = 0;
+    }
+    pthread_cond_broadcast(&handoff_resume);
+    pthread_mutex_unlock(&client_mutex);
+    bus_resume();
+    if (io_backend != IO_BACKEND_THREADS) {
+        io_wake();
+    }
+    printf("handoff : %d clients resumed.\n", count);
+}
+
+//    :   ؼ  ϰ Ŭ̾Ʈ (*clients),  ¸ ,   ȯ(и -1)
+int handoff_receive(int port, ClientStart** clients) {
+    struct sockaddr_un addr = { 0 };
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), HANDOFF_PATH_FMT, port);
+    int h = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (h < 0 || connect(h, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("handoff connect fail");
+        if (h >= 0) close(h);
+        return -1;
+    }
+    if (handoff_send_rec(h, "takeover", -1) < 0) {
+        close(h);
+        return -1;
+    }
+
+    int server_sock = -1;
+    int count = 0;
+    int ended = 0;           // end (߰   Ϻΰ Ƿ ̾ )
+    char rec[HANDOFF_REC_LEN];
+    int fd;
+    while (handoff_recv_rec(h, rec, &fd) == 0) {
+        char room_number[BUF_SIZE] = { 0 };
+        if (strcmp(rec, "end") == 0) {
+            ended = 1;
+            break;
+        }
+        else if (strcmp(rec, "listen") == 0) {
+            server_sock = fd;
+            continue;
+        }
+        else if (strncmp(rec, "client:", 7) == 0 && fd >= 0) {
+            size_t hello_len = strlen(rec + 7);
+            if (hello_len >= BUF_SIZE) {
+                printf("takeover : hello too long, client dropped.\n"); // Ʒ  Ŭ̾Ʈ ٽ 
+            }
+            else {
+                ClientStart* start = (ClientStart*)slab_zalloc(&client_start_slab);
+                start->sock = fd;
+                memcpy(start->hello, rec + 7, hello_len + 1);
+                start->next = *clients;
+                *clients = start;
+                count++;
+                continue;
+            }
+        }
+        else if (strncmp(rec, "room:", 5) == 0) {
+            RoomNode n = { 0 };
+            if (sscanf(rec, "room:%9[^:]:%lf:%lld:%lld:%lld:%lld:%u:%lld:%lf:%lld:%u:%u:%u", room_number,
+                &n.event_tokens, &n.token_refill_ms, &n.last_event_ms[0], &n.last_event_ms[1], &n.last_event_ms[2],
+                &n.dropped_events, &n.cmd_rtt_last_ms, &n.cmd_rtt_avg_ms, &n.cmd_rtt_max_ms,
+                &n.cmd_acked, &n.cmd_nacked, &n.cmd_timeouts) == 13) {
+                RoomNode* node = find_room_node(room_number);
+                if (!node) {
+                    node = create_room_node(room_number);
+                    add_room_node(node);
+                }
+                node->event_tokens = n.event_tokens;
+                node->token_refill_ms = n.token_refill_ms;
+                memcpy(node->last_event_ms, n.last_event_ms, sizeof(n.last_event_ms));
+                node->dropped_events = n.dropped_events;
+                node->cmd_rtt_last_ms = n.cmd_rtt_last_ms;
+                node->cmd_rtt_avg_ms = n.cmd_rtt_avg_ms;
+                node->cmd_rtt_max_ms = n.cmd_rtt_max_ms;
+                node->cmd_acked = n.cmd_acked;
+                node->cmd_nacked = n.cmd_nacked;
+                node->cmd_timeouts = n.cmd_timeouts;
+            }
+        }
+        else if (strncmp(rec, "state:", 6) == 0) {
+            RoomState t = { 0 };
+            char door[16] = { 0 };
+            if (sscanf(rec, "state:%9[^:]:%64[^:]:%d:%d:%15[^:]:%lld:%u:%u:%u:%d:%lld:%64s", room_number,
+                t.pw_hash, &t.esp_online, &t.fr_online, door, &t.last_open_ms, &t.open_count,
+                &t.wrong_password_count, &t.intruder_count, &t.last_event, &t.last_event_ms, t.last_image) == 12) {
+                pthread_rwlock_wrlock(&room_state_lock);
+                RoomState* st = room_state_find_or_add(room_number);
+                if (strcmp(t.pw_hash, "-") != 0) {
+                    strcpy(st->pw_hash, t.pw_hash);
+                    st->pw_loaded = 1;
+                }
+                st->esp_online = t.esp_online;
+                st->fr_online = t.fr_online;
+                st->door = strcmp(door, "locked") == 0 ? "locked" : strcmp(door, "opening") == 0 ? "opening" : "unknown";
+                st->last_open_ms = t.last_open_ms;
+                st->open_count = t.open_count;
+                st->wrong_password_count = t.wrong_password_count;
+                st->intruder_count = t.intruder_count;
+                st->last_event = t.last_event;
+                st->last_event_ms = t.last_event_ms;
+                if (strcmp(t.last_image, "-") != 0) strcpy(st->last_image, t.last_image);
+                pthread_rwlock_unlock(&room_state_lock);
+            }
+        }
+        else if (strncmp(rec, "cred:", 5) == 0) {
+            uint32_t version = 0;
+            int uids_loaded = 0;
+            char salt[CRED_SALT_LEN + 1] = { 0 };
+            char salted[IMAGE_HASH_LEN + 1] = { 0 };
+            char list[CRED_MAX_UIDS * (CRED_UID_LEN + 1) + 1] = { 0 };
+            if (sscanf(rec, "cred:%9[^:]:%u:%32[^:]:%64[^:]:%d:%672s", room_number, &version, salt, salted,
+                &uids_loaded, list) == 6) {
+                pthread_rwlock_wrlock(&room_state_lock);
+                RoomState* st = room_state_find_or_add(room_number);
+                st->cred_version = st->cred_log_base = version;
+                if (strcmp(salt, "-") != 0 && strcmp(salted, "-") != 0) {
+                    strcpy(st->pw_salt, salt);
+                    strcpy(st->pw_salted, salted);
+                }
+                st->uid_count = 0;
+                for (char* save = NULL, *uid = strtok_r(list, ",", &save); uid && st->uid_count < CRED_MAX_UIDS; uid = strtok_r(NULL, ",", &save)) {
+                    if (cred_uid_normalize(uid, st->uids[st->uid_count]) == 0) st->uid_count++;
+                }
+                st->uids_loaded = uids_loaded;
+                pthread_rwlock_unlock(&room_state_lock);
+            }
+        }
+        else if (strncmp(rec, "lock:", 5) == 0) {
+            long long until = 0;
+            unsigned int lockouts = 0;
+            int skip = 0;
+            if (sscanf(rec, "lock:%9[^:]:%lld:%u%n", room_number, &until, &lockouts, &skip) == 3) {
+                AttemptSlot* slot = attempt_slot(room_number, 1);
+                if (slot) {
+                    atomic_store(&slot->locked_until_ms, until);
+                    atomic_store(&slot->lockouts, lockouts);
+                    const char* p = rec + skip;
+                    for (int c = 0; c < CRED_COUNT; c++) {
+                        for (int i = 0; i < LOCKOUT_BUCKETS && *p == ':'; i++) {
+                            unsigned long long v = strtoull(p + 1, (char**)&p, 10);
+                            atomic_store(&slot->buckets[c][i], v);
+                        }
+                    }
+                }
+            }
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    if (server_sock < 0 || !ended || handoff_send_rec(h, "ok", -1) < 0) {
+        close(h);
+        return -1;
+    }
+    close(h);
+    printf("takeover : %d clients resumed.\n", count);
+    return server_sock;
+}
+
+// I/O  ̸ -> IO_BACKEND_*, 𸣴 ̸̸ -1
+int io_backend_by_name(const char* name) {
+    if (strcmp(name, "threads") == 0) return IO_BACKEND_THREADS;
+    if (strcmp(name, "epoll") == 0) return IO_BACKEND_EPOLL;
+    if (strcmp(name, "uring") == 0) return IO_BACKEND_URING;
+    return -1;
+}
+
+// ۾  ť ֱ,   ۾ ׻  ۾  Ƿ  
+void io_enqueue(Client* c, int kind, IoJob* job) {
+    if (!job) {
+        job = io_job_alloc(0);
+    }
+    job->client = c;
+    job->kind = kind;
+    job->next = NULL;
+    IoWorker* w = &io_workers[c->worker];
+    pthread_mutex_lock(&w->lock);
+    if (w->tail) w->tail->next = job;
+    else w->head = job;
+    w->tail = job;
+    pthread_cond_signal(&w->ready);
+    pthread_mutex_unlock(&w->lock);
+}
+
+//  ͸  ۾(data len + 1 Ʈ, len RECV_BUF_SIZE ), Ǯ  0 ä 
+IoJob* io_job_alloc(int len) {
+    IoJob* job = (IoJob*)slab_alloc(&io_job_slab);
+    job->len = len;
+    return job;
+}
+
+// ۾  : Ằ λ縻/޽ ó,   
+void* io_worker_thread(void* arg) {
+    IoWorker* w = (IoWorker*)arg;
+    while (1) {
+        pthread_mutex_lock(&w->lock);
+        while (!w->head) {
+            pthread_cond_wait(&w->ready, &w->lock);
+        }
+        IoJob* job = w->head;
+        w->head = job->next;
+        if (!w->head) w->tail = NULL;
+        pthread_mutex_unlock(&w->lock);
+
+        Client* c = job->client;
+        if (job->kind == IO_JOB_DATA || job->kind == IO_JOB_RESUME) {
+            if (c->closing || (c->self && c->self->parked)) {
+                // ݴ ̰ų ѱ ῡ  ʹ 
+            }
+            else if (!c->hello_done) {
+                int offset = client_hello(c, job->data, job->len, w->conn, job->kind == IO_JOB_RESUME);
+                if (offset < 0) {
+                    c->closing = 1;
+                    shutdown(c->sock, SHUT_RDWR); // I/O 尡   ݱ ۾ 
+                }
+                else if (offset < job->len) {
+                    client_feed(c, job->data + offset, job->len - offset, w->conn);
+                }
+            }
+            else {
+                client_feed(c, job->data, job->len, w->conn);
+            }
+        }
+        else if (job->kind == IO_JOB_PARK) {
+            // I/O 尡 б⸦    ۾̹Ƿ տ  ʹ  ó 
+            if (c->self && client_idle(c) && !c->closing) {
+                pthread_mutex_lock(&client_mutex);
+                if (handoff_should_park(c->type)) c->self->parked = 1; //   ѱⰡ  ״ 
+                pthread_mutex_unlock(&client_mutex);
+            }
+            else {
+                printf("handoff : room %s busy, not parked.\n", c->room_number);
+            }
+        }
+        else if (job->kind == IO_JOB_CLOSE) {
+            printf("client close.\n");
+            if (c->type == CLIENT_TYPE_WEB) {
+                //   ݱ    ٸǷ ۾ 带  ʰ  ó
+                pthread_t tid;
+                if (pthread_create(&tid, NULL, io_close_thread, c) == 0) {
+                    pthread_detach(tid);
+                }
+                else {
+                    client_finish(c);
+                }
+            }
+            else {
+                client_finish(c);
+            }
+        }
+        slab_free(&io_job_slab, job);
+    }
+    return NULL;
+}
+
+void* io_close_thread(void* arg) {
+    client_finish((Client*)arg);
+    return NULL;
+}
+
+// I/O   (I/O 常 )
+void io_list_add(Client* c) {
+    c->worker = (int)(io_next_worker++ % IO_WORKERS);
+    c->reading = 1;
+    c->prev = NULL;
+    c->next = io_clients;
+    if (io_clients) io_clients->prev = c;
+    io_clients = c;
+}
+
+void io_list_remove(Client* c) {
+    if (c->prev) c->prev->next = c->next;
+    else io_clients = c->next;
+    if (c->next) c->next->prev = c->prev;
+    c->prev = c->next = NULL;
+}
+
+//  ܰ谡 ٲ I/O 忡 ˸
+void io_wake(void) {
+    uint64_t one = 1;
+    if (io_wake_fd >= 0 && write(io_wake_fd, &one, sizeof(one)) < 0) {
+        perror("io wake fail");
+    }
+}
+
+// epoll :  Ʈ, غ ϸ recv  ( ŷ ״ : ٸ    )
+void* io_epoll_loop(void* arg) {
+    struct epoll_event events[IO_BATCH];
+    int listening = 1;
+    while (1) {
+        int n = epoll_wait(io_epoll_fd, events, IO_BATCH, -1);
+        if (n < 0) {
+            if (errno != EINTR) perror("epoll_wait fail");
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            void* ptr = events[i].data.ptr;
+            if (ptr == &io_listen_sock) {
+                int sock = accept(io_listen_sock, NULL, NULL);
+                if (sock < 0) {
+                    perror("accept fail");
+                    continue;
+                }
+                Client* c = (Client*)slab_zalloc(&client_slab);
+                c->sock = sock;
+                io_list_add(c);
+                struct epoll_event ev = { EPOLLIN, { .ptr = c } };
+                epoll_ctl(io_epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+            }
+            else if (ptr == &io_wake_fd) {
+                uint64_t count;
+                if (read(io_wake_fd, &count, sizeof(count)) < 0) continue;
+                if (atomic_load(&handoff_phase) > 0 && listening) {
+                    epoll_ctl(io_epoll_fd, EPOLL_CTL_DEL, io_listen_sock, NULL); //     
+                    listening = 0;
+                }
+                else if (atomic_load(&handoff_phase) == 0 && !listening) {
+                    // ѱ  : ٽ accept ϰ   ٽ 
+                    struct epoll_event ev = { EPOLLIN, { .ptr = &io_listen_sock } };
+                    epoll_ctl(io_epoll_fd, EPOLL_CTL_ADD, io_listen_sock, &ev);
+                    listening = 1;
+                    for (Client* c = io_clients; c; c = c->next) {
+                        if (!c->stopped) continue;
+                        struct epoll_event cev = { EPOLLIN, { .ptr = c } };
+                        epoll_ctl(io_epoll_fd, EPOLL_CTL_ADD, c->sock, &cev);
+                        c->stopped = 0;
+                        c->reading = 1;
+                    }
+                }
+                for (Client* c = io_clients; c; c = c->next) {
+                    if (c->reading && handoff_should_park(c->type)) {
+                        epoll_ctl(io_epoll_fd, EPOLL_CTL_DEL, c->sock, NULL);
+                        c->reading = 0;
+                        c->stopped = 1;
+                        io_enqueue(c, IO_JOB_PARK, NULL);
+                    }
+                }
+            }
+            else {
+                Client* c = (Client*)ptr;
+                if (!c->reading) continue;
+                IoJob* job = io_job_alloc(RECV_BUF_SIZE - 1);
+                int received = recv(c->sock, job->data, RECV_BUF_SIZE - 1, 0);
+                if (received < 0 && errno == EINTR) {
+                    slab_free(&io_job_slab, job);
+                    continue;
+                }
+                if (received <= 0) {
+                    slab_free(&io_job_slab, job);
+                    epoll_ctl(io_epoll_fd, EPOLL_CTL_DEL, c->sock, NULL);
+                    c->reading = 0;
+                    io_list_remove(c);
+                    io_enqueue(c, IO_JOB_CLOSE, NULL);
+                    continue;
+                }
+                job->len = received;
+                io_enqueue(c, IO_JOB_DATA, job);
+            }
+        }
+    }
+    return NULL;
+}
+
+#ifdef HAVE_LIBURING
+// io_uring : Ƽ accept/recv, recv ۴ Ŀ    (  ٷ ȯ)
+// ϷḦ IO_BATCH   óϰ   ⸦ syscall  
+struct io_uring io_ring;
+struct io_uring_buf_ring* io_buf_ring;
+char* io_bufs;
+
+struct io_uring_sqe* io_sqe(void) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&io_ring);
+    while (!sqe) {
+        io_uring_submit(&io_ring); //  ť    
+        sqe = io_uring_get_sqe(&io_ring);
+    }
+    return sqe;
+}
+
+void io_uring_arm_recv(Client* c) {
+    struct io_uring_sqe* sqe = io_sqe();
+    io_uring_prep_recv_multishot(sqe, c->sock, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IO_BUF_GROUP;
+    io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)c);
+}
+
+void io_uring_arm_accept(void) {
+    struct io_uring_sqe* sqe = io_sqe();
+    io_uring_prep_multishot_accept(sqe, io_listen_sock, NULL, NULL, 0);
+    io_uring_sqe_set_data64(sqe, IO_TAG_ACCEPT);
+}
+
+void io_uring_arm_wake(void) {
+    struct io_uring_sqe* sqe = io_sqe();
+    io_uring_prep_poll_multishot(sqe, io_wake_fd, POLLIN);
+    io_uring_sqe_set_data64(sqe, IO_TAG_WAKE);
+}
+
+void io_uring_cancel(uint64_t tag) {
+    struct io_uring_sqe* sqe = io_sqe();
+    io_uring_prep_cancel64(sqe, tag, 0);
+    io_uring_sqe_set_data64(sqe, IO_TAG_CANCEL);
+}
+
+//    غ, Ŀ/̺귯   -1(epoll )
+int io_uring_setup_ring(void) {
+    int ret = io_uring_queue_init(IO_URING_ENTRIES, &io_ring, 0);
+    if (ret < 0) {
+        fprintf(stderr, "io_uring init fail : %s\n", strerror(-ret));
+        return -1;
+    }
+    io_buf_ring = io_uring_setup_buf_ring(&io_ring, IO_BUF_COUNT, IO_BUF_GROUP, 0, &ret);
+    if (!io_buf_ring) {
+        fprintf(stderr, "io_uring buffer ring fail : %s\n", strerror(-ret));
+        io_uring_queue_exit(&io_ring);
+        return -1;
+    }
+    io_bufs = (char*)malloc((size_t)IO_BUF_COUNT * RECV_BUF_SIZE);
+    for (int i = 0; i < IO_BUF_COUNT; i++) {
+        io_uring_buf_ring_add(io_buf_ring, io_bufs + (size_t)i * RECV_BUF_SIZE, RECV_BUF_SIZE, i,
+            io_uring_buf_ring_mask(IO_BUF_COUNT), i);
+    }
+    io_uring_buf_ring_advance(io_buf_ring, IO_BUF_COUNT);
+    return 0;
+}
+
+void* io_uring_loop(void* arg) {
+    int listening = 1;
+    int accepting = 1; // Ƽ accept ϵǾ (ص Ϸᰡ   1)
+    io_uring_arm_accept();
+    io_uring_arm_wake();
+    for (Client* c = io_clients; c; c = c->next) {
+        io_uring_arm_recv(c);
+    }
+
+    while (1) {
+        int ret = io_uring_submit_and_wait(&io_ring, 1);
+        if (ret < 0 && ret != -EINTR) {
+            fprintf(stderr, "io_uring wait fail : %s\n", strerror(-ret));
+            continue;
+        }
+        struct io_uring_cqe* cqe;
+        unsigned head;
+        unsigned seen = 0;
+        io_uring_for_each_cqe(&io_ring, head, cqe) {
+            seen++;
+            uint64_t tag = io_uring_cqe_get_data64(cqe);
+            int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+            if (tag == IO_TAG_CANCEL) {
+                continue;
+            }
+            if (tag == IO_TAG_ACCEPT) {
+                if (cqe->res >= 0) {
+                    Client* c = (Client*)slab_zalloc(&client_slab);
+                    c->sock = cqe->res;
+                    io_list_add(c);
+                    io_uring_arm_recv(c);
+                }
+                if (!more) {
+                    accepting = listening;
+                    if (listening) io_uring_arm_accept();
+                }
+                continue;
+            }
+            if (tag == IO_TAG_WAKE) {
+                uint64_t count;
+                if (read(io_wake_fd, &count, sizeof(count)) < 0) {
+                    //  ˸ ٽ 
+                }
+                if (!more) io_uring_arm_wake();
+                if (atomic_load(&handoff_phase) > 0 && listening) {
+                    io_uring_cancel(IO_TAG_ACCEPT); //     
+                    listening = 0;
+                }
+                else if (atomic_load(&handoff_phase) == 0 && !listening) {
+                    // ѱ  : ٽ accept ϰ   ٽ (  Ϸ  recv Ϸῡ ٽ )
+                    listening = 1;
+                    if (!accepting) {
+                        io_uring_arm_accept();
+                        accepting = 1;
+                    }
+                    for (Client* c = io_clients; c; c = c->next) {
+                        if (c->stopped) {
+                            c->stopped = 0;
+                            io_uring_arm_recv(c);
+                        }
+                        c->reading = 1;
+                    }
+                }
+                for (Client* c = io_clients; c; c = c->next) {
+                    if (c->reading && handoff_should_park(c->type)) {
+                        c->reading = 0; // Ƽ recv  Ϸῡ PARK ۾ 
+                        io_uring_cancel((uint64_t)(uintptr_t)c);
+                    }
+                }
+                continue;
+            }
+
+            Client* c = (Client*)(uintptr_t)tag;
+            if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+                int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                char* buf = io_bufs + (size_t)bid * RECV_BUF_SIZE;
+                IoJob* job = io_job_alloc(cqe->res);
+                memcpy(job->data, buf, cqe->res);
+                io_uring_buf_ring_add(io_buf_ring, buf, RECV_BUF_SIZE, bid, io_uring_buf_ring_mask(IO_BUF_COUNT), 0);
+                io_uring_buf_ring_advance(io_buf_ring, 1);
+                io_enqueue(c, IO_JOB_DATA, job);
+            }
+            if (more) {
+                continue;
+            }
+            // Ƽ recv  : ̸ ݱ,   ѱ غ,    ٽ 
+            if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)) {
+                c->reading = 0;
+                io_list_remove(c);
+                io_enqueue(c, IO_JOB_CLOSE, NULL);
+            }
+            else if (!c->reading) {
+                c->stopped = 1;
+                io_enqueue(c, IO_JOB_PARK, NULL);
+            }
+            else {
+                io_uring_arm_recv(c);
+            }
+        }
+        io_uring_cq_advance(&io_ring, seen);
+    }
+    return NULL;
+}
+#endif
+
+// ̺Ʈ   : ۾ , Ѱܹ , I/O  غ,   ȯ(и -1)
+int io_start(int backend, int server_sock, ClientStart* resumed) {
+#ifdef HAVE_LIBURING
+    if (backend == IO_BACKEND_URING && io_uring_setup_ring() < 0) {
+        backend = IO_BACKEND_EPOLL;
+    }
+#else
+    if (backend == IO_BACKEND_URING) {
+        fprintf(stderr, "io_uring : not built with liburing(HAVE_LIBURING), use epoll.\n");
+        backend = IO_BACKEND_EPOLL;
+    }
+#endif
+    io_listen_sock = server_sock;
+    io_wake_fd = eventfd(0, 0);
+    if (io_wake_fd < 0) {
+        perror("eventfd fail");
+        return -1;
+    }
+    for (int i = 0; i < IO_WORKERS; i++) {
+        IoWorker* w = &io_workers[i];
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->ready, NULL);
+        w->conn = mysql_init(NULL);
+        if (!mysql_real_connect(w->conn, server, user, password, database, 0, NULL, 0)) {
+            fprintf(stderr, "DB connect error : %s\n", mysql_error(w->conn));
+            return -1;
+        }
+        pthread_create(&w->tid, NULL, io_worker_thread, w);
+    }
+
+    // Ѱܹ  λ縻 ó(I/O 尡 ۵Ǳ ̶ ù ۾ )
+    while (resumed) {
+        ClientStart* start = resumed;
+        resumed = start->next;
+        Client* c = (Client*)slab_zalloc(&client_slab);
+        c->sock = start->sock;
+        io_list_add(c);
+        IoJob* job = io_job_alloc(strlen(start->hello));
+        memcpy(job->data, start->hello, job->len);
+        io_enqueue(c, IO_JOB_RESUME, job);
+        slab_free(&client_start_slab, start);
+    }
+
+    pthread_t tid;
+#ifdef HAVE_LIBURING
+    if (backend == IO_BACKEND_URING) {
+        pthread_create(&tid, NULL, io_uring_loop, NULL);
+        return backend;
+    }
+#endif
+    io_epoll_fd = epoll_create1(0);
+    if (io_epoll_fd < 0) {
+        perror("epoll_create fail");
+        return -1;
+    }
+    struct epoll_event ev = { EPOLLIN, { .ptr = &io_listen_sock } };
+    epoll_ctl(io_epoll_fd, EPOLL_CTL_ADD, server_sock, &ev);
+    ev.data.ptr = &io_wake_fd;
+    epoll_ctl(io_epoll_fd, EPOLL_CTL_ADD, io_wake_fd, &ev);
+    for (Client* c = io_clients; c; c = c->next) {
+        ev.data.ptr = c;
+        epoll_ctl(io_epoll_fd, EPOLL_CTL_ADD, c->sock, &ev);
+    }
+    pthread_create(&tid, NULL, io_epoll_loop, NULL);
+    return backend;
+}
+
+// Ǯ ü ϳ (   ״),   ûũ ϳ   
+void* slab_alloc(Slab* slab) {
+    pthread_mutex_lock(&slab->lock);
+    if (!slab->free_list) {
+        size_t size = (slab->size + 15) & ~(size_t)15;
+        size_t count = SLAB_CHUNK_BYTES / size;
+        if (count == 0) count = 1;
+        char* chunk = (char*)malloc(size * count);
+        if (!chunk) {
+            pthread_mutex_unlock(&slab->lock);
+            return NULL;
+        }
+        for (size_t i = count; i > 0; i--) {
+            void** obj = (void**)(chunk + (i - 1) * size);
+            *obj = slab->free_list;
+            slab->free_list = obj;
+        }
+        slab->chunks++;
+    }
+    void** obj = (void**)slab->free_list;
+    slab->free_list = *obj;
+    slab->allocs++;
+    if (++slab->in_use > slab->peak) slab->peak = slab->in_use;
+    pthread_mutex_unlock(&slab->lock);
+    return obj;
+}
+
+// 0 ä ü(calloc )
+void* slab_zalloc(Slab* slab) {
+    void* obj = slab_alloc(slab);
+    if (obj) memset(obj, 0, slab->size);
+    return obj;
+}
+
+void slab_free(Slab* slab, void* obj) {
+    if (!obj) return;
+    pthread_mutex_lock(&slab->lock);
+    *(void**)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->frees++;
+    slab->in_use--;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+// Ǯ 뷮 "≮>=< >/<ִ>/<Ҵ >/< >/<ûũ >:..."
+int slab_format(char* out, size_t out_size) {
+    size_t len = 0;
+    out[0] = '\0';
+    for (size_t i = 0; i < sizeof(slabs) / sizeof(slabs[0]) && len < out_size; i++) {
+        Slab* slab = slabs[i];
+        pthread_mutex_lock(&slab->lock);
+        len += snprintf(out + len, out_size - len, "%s%s=%lu/%lu/%lu/%lu/%lu", i ? ":" : "", slab->name,
+            slab->in_use, slab->peak, slab->allocs, slab->frees, slab->chunks);
+        pthread_mutex_unlock(&slab->lock);
+    }
+    return (int)len;
+}
+
+// ť ó  , 帶 DB  ϳ
+int dispatch_start(void) {
+    for (int i = 0; i < DISPATCH_WORKERS; i++) {
+        MYSQL* conn = mysql_init(NULL);
+        if (!mysql_real_connect(conn, server, user, password, database, 0, NULL, 0)) {
+            fprintf(stderr, "DB connect error : %s\n", mysql_error(conn));
+            return -1;
+        }
+        pthread_t tid;
+        pthread_create(&tid, NULL, dispatch_worker_thread, conn);
+        pthread_detach(tid);
+    }
+    return 0;
+}
+
+// Ŭ ť  ߰, ť   (task ) -1 ȯ
+int dispatch_push(DispatchTask* task) {
+    DispatchQueue* q = &dispatch_queues[task->prio];
+    task->queued_ms = now_ms();
+    task->next = NULL;
+    pthread_mutex_lock(&dispatch_mutex);
+    if (q->count >= DISPATCH_QUEUE_MAX) {
+        q->dropped++;
+        pthread_mutex_unlock(&dispatch_mutex);
+        end_image_upload(&task->upload);
+        slab_free(&task_slab, task);
+        return -1;
+    }
+    if (q->tail) q->tail->next = task;
+    else q->head = task;
+    q->tail = task;
+    q->count++;
+    pthread_cond_signal(&dispatch_ready);
+    pthread_mutex_unlock(&dispatch_mutex);
+    return 0;
+}
+
+//  ۾ :   ۾  ѱ Ŭ    Ŭ,  ۾ ִ   Ŭ
+DispatchTask* dispatch_take(void) {
+    pthread_mutex_lock(&dispatch_mutex);
+    int prio = -1;
+    while (1) {
+        long long now = now_ms();
+        for (int p = PRIO_ADMIN; p < PRIO_COUNT && prio < 0; p++) {
+            DispatchTask* head = dispatch_queues[p].head;
+            if (head && now - head->queued_ms > prio_budget_ms[p]) prio = p;
+        }
+        for (int p = PRIO_ADMIN; p < PRIO_COUNT && prio < 0; p++) {
+            if (dispatch_queues[p].head) prio = p;
+        }
+        if (prio >= 0) break;
+        pthread_cond_wait(&dispatch_ready, &dispatch_mutex);
+    }
+    DispatchQueue* q = &dispatch_queues[prio];
+    DispatchTask* task = q->head;
+    q->head = task->next;
+    if (!q->head) q->tail = NULL;
+    q->count--;
+    dispatch_busy++;
+    pthread_mutex_unlock(&dispatch_mutex);
+    return task;
+}
+
+// ۾ Ϸ : ť     ð Ŭ  , task 
+void dispatch_done(DispatchTask* task) {
+    long long elapsed = now_ms() - task->queued_ms;
+    DispatchQueue* q = &dispatch_queues[task->prio];
+    pthread_mutex_lock(&dispatch_mutex);
+    q->done++;
+    if (elapsed > prio_budget_ms[task->prio]) q->late++;
+    if (elapsed > q->max_ms) q->max_ms = elapsed;
+    dispatch_busy--;
+    pthread_mutex_unlock(&dispatch_mutex);
+    end_image_upload(&task->upload);
+    slab_free(&task_slab, task);
+}
+
+void* dispatch_worker_thread(void* arg) {
+    MYSQL* conn = (MYSQL*)arg;
+    //  常 켱 (ħ    尡 CPU  )
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), DISPATCH_NICE);
+    while (1) {
+        DispatchTask* task = dispatch_take();
+        dispatch_run(task, conn);
+        dispatch_done(task);
+    }
+    return NULL;
+}
+
+void dispatch_run(DispatchTask* task, MYSQL* conn) {
+    if (task->kind == TASK_STORE_UPLOAD) {
+        char hash[IMAGE_HASH_LEN + 1];
+        if (store_upload(task->room_number, &task->upload, hash) != 0) {
+            printf("FR: room %s image store fail.\n", task->room_number);
+            return;
+        }
+        strcpy(task->value, hash); //  ؽ÷ 
+    }
+    if (task->kind == TASK_LOG_IMAGE || task->kind == TASK_STORE_UPLOAD) {
+        save_image_path(conn, task->value, task->room_number);
+        bus_publish(task->bus_kind, task->room_number, task->value);
+    }
+    else if (task->kind == TASK_CHANGE_PW) {
+        // DB   ϸ ĳ ,   ٷ  ؽ 
+        char reply[BUF_SIZE];
+        uint32_t version = 0;
+        int ok = change_password(conn, task->value, task->room_number) == 0 &&
+            room_state_set_password(task->room_number, task->value, &version) == 0;
+        if (ok) {
+            bus_publish(BUS_PASSWORD_CHANGED, task->room_number, NULL);
+            cred_sync(task->room_number, version - 1, conn);
+        }
+        snprintf(reply, sizeof(reply), "WEB:room_%s:change_PW:%s\n", task->room_number, ok ? "ok" : "fail");
+        web_reply(task->web, task->tag, reply);
+        web_conn_release(task->web);
+    }
+    else if (task->kind == TASK_CARD) {
+        //  ٲ  DB (̹  ¸ ״ ok) ĳ ,   ٷ  
+        char reply[BUF_SIZE];
+        uint32_t version = 0;
+        int change = room_state_get(task->room_number, conn) ? room_state_uid_change(task->room_number, task->value, task->add) : -1;
+        int ok = change == 0 || (change == 1 && change_card(conn, task->value, task->room_number, task->add) == 0);
+        if (change == 1 && ok && room_state_set_uid(task->room_number, task->value, task->add, &version) == 0) {
+            cred_sync(task->room_number, version - 1, conn);
+        }
+        snprintf(reply, sizeof(reply), "WEB:room_%s:%s:%s\n", task->room_number, task->add ? "add_uid" : "del_uid", ok ? "ok" : "fail");
+        web_reply(task->web, task->tag, reply);
+        web_conn_release(task->web);
+    }
+}
+
+//    ESP   ȣ : ޽ ó ۺ ۱ ð 
+void dispatch_door_done(long long start_ms) {
+    long long elapsed = now_ms() - start_ms;
+    DispatchQueue* q = &dispatch_queues[PRIO_DOOR];
+    pthread_mutex_lock(&dispatch_mutex);
+    q->done++;
+    if (elapsed > prio_budget_ms[PRIO_DOOR]) q->late++;
+    if (elapsed > q->max_ms) q->max_ms = elapsed;
+    pthread_mutex_unlock(&dispatch_mutex);
+}
+
+// ̹ ؽ DB ϰ ̺Ʈ  PRIO_LOG ť
+void dispatch_log(const char* room_number, const char* image_path, int bus_kind) {
+    DispatchTask* task = (DispatchTask*)slab_zalloc(&task_slab);
+    task->prio = PRIO_LOG;
+    task->kind = TASK_LOG_IMAGE;
+    strcpy(task->room_number, room_number);
+    snprintf(task->value, sizeof(task->value), "%s", image_path);
+    task->bus_kind = bus_kind;
+    dispatch_push(task);
+}
+
+//  ̹  +  PRIO_LOG ť, ̹ ʹ ۾ Ѿ(up  )
+void dispatch_upload(const char* room_number, ImageUpload* up, int bus_kind) {
+    DispatchTask* task = (DispatchTask*)slab_zalloc(&task_slab);
+    task->prio = PRIO_LOG;
+    task->kind = TASK_STORE_UPLOAD;
+    strcpy(task->room_number, room_number);
+    task->bus_kind = bus_kind;
+    task->upload = *up;
+    up->data = NULL;
+    dispatch_push(task);
+}
+
+// йȣ  PRIO_ADMIN ť,  ó 尡 (ť   -1)
+int dispatch_change_password(WebConn* web, const char* tag, const char* room_number, const char* pw) {
+    DispatchTask* task = (DispatchTask*)slab_zalloc(&task_slab);
+    task->prio = PRIO_ADMIN;
+    task->kind = TASK_CHANGE_PW;
+    strcpy(task->room_number, room_number);
+    snprintf(task->value, sizeof(task->value), "%s", pw);
+    task->web = web;
+    strcpy(task->tag, tag);
+    web_conn_hold(web);
+    if (dispatch_push(task) < 0) {
+        web_conn_release(web);
+        return -1;
+    }
+    return 0;
+}
+
+// ī ߰/ PRIO_ADMIN ť,  ó 尡 (ť   -1)
+int dispatch_card(WebConn* web, const char* tag, const char* room_number, const char* uid, int add) {
+    DispatchTask* task = (DispatchTask*)slab_zalloc(&task_slab);
+    task->prio = PRIO_ADMIN;
+    task->kind = TASK_CARD;
+    strcpy(task->room_number, room_number);
+    snprintf(task->value, sizeof(task->value), "%s", uid);
+    task->add = add;
+    task->web = web;
+    strcpy(task->tag, tag);
+    web_conn_hold(web);
+    if (dispatch_push(task) < 0) {
+        web_conn_release(web);
+        return -1;
+    }
+    return 0;
+}
+
+int dispatch_idle(void) {
+    pthread_mutex_lock(&dispatch_mutex);
+    int idle = dispatch_busy == 0;
+    for (int p = PRIO_ADMIN; p < PRIO_COUNT; p++) {
+        if (dispatch_queues[p].count > 0) idle = 0;
+    }
+    pthread_mutex_unlock(&dispatch_mutex);
+    return idle;
+}
+
+// ť   ٸ( , ִ FORWARD_TIMEOUT_MS)
+void dispatch_drain(void) {
+    long long deadline = now_ms() + FORWARD_TIMEOUT_MS;
+    while (!dispatch_idle()) {
+        if (now_ms() >= deadline) {
+            printf("handoff : dispatch queue not empty, continue.\n");
+            return;
+        }
+        usleep(20000);
+    }
+}
+
+// "<Ŭ>=<>/<ó>/< ʰ>/<ִ ms>/<>:..."   
+int dispatch_format(char* out, size_t out_size) {
+    size_t len = 0;
+    out[0] = '\0';
+    pthread_mutex_lock(&dispatch_mutex);
+    for (int p = 0; p < PRIO_COUNT && len < out_size; p++) {
+        DispatchQueue* q = &dispatch_queues[p];
+        len += snprintf(out + len, out_size - len, "%s%s=%d/%lu/%lu/%lld/%lu", p ? ":" : "", prio_name[p],
+            q->count, q->done, q->late, q->max_ms, q->dropped);
+    }
+    pthread_mutex_unlock(&dispatch_mutex);
+    return 0;
+}
+
+// FR ν    κ :  Ǵ, ̺Ʈ  ϸ ESP  ȣ,  ̺Ʈ 1 ȯ
+int fr_failure(RoomNode* room_node, const char* room_number, long long start_ms) {
+    long long lock_ms = record_attempt(room_number, CRED_FACE, 0);
+    if (lock_ms > 0) {
+        begin_lockout(room_node, lock_ms, cred_name[CRED_FACE]);
+    }
+    if (!allow_room_event(room_node, EVENT_FAILURE)) {
+        return 0;
+    }
+    printf("FR: room %s fail face recognition. to ESP32 send signal...\n", room_number);
+    if (send_room_command(room_node, "failure", NULL, NULL, NULL, NULL) == 0) {
+        printf("Not found room %s.\n", room_number);
+        return 0;
+    }
+    dispatch_door_done(start_ms);
+    return 1;
+}
+
+uint64_t persist_sum(const void* data, size_t len, uint64_t h) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+uint64_t wal_sum(const WalRecord* w) {
+    return persist_sum(&w->room, sizeof(w->room), persist_sum(&w->seq, sizeof(w->seq), 14695981039346656037ull));
+}
+
+//  ° ٲ ȣ :  ֱ⿡ WAL (   )
+void persist_mark(const char* room_number) {
+    if (room_number[0] == '\0' || strlen(room_number) >= sizeof(persist_dirty[0])) return;
+    uint64_t h = hash64(room_number);
+    pthread_mutex_lock(&persist_mutex);
+    for (unsigned int i = 0; i < PERSIST_DIRTY_SLOTS && !persist_overflow; i++) {
+        char* slot = persist_dirty[(h + i) & (PERSIST_DIRTY_SLOTS - 1)];
+        if (strcmp(slot, room_number) == 0) break;
+        if (slot[0] == '\0') {
+            strcpy(slot, room_number);
+            if (++persist_dirty_count > PERSIST_DIRTY_SLOTS / 2) persist_overflow = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&persist_mutex);
+}
+
+//  ϳ  ¸ ڵ( ĳ, ,   ), 𸣴 ̸ -1
+int persist_fill(const char* room_number, SnapRecord* r) {
+    int found = 0;
+    memset(r, 0, sizeof(*r)); //  κе 0̾ üũ 
+    strcpy(r->room_number, room_number);
+    r->last_event = -1;
+    pthread_rwlock_rdlock(&room_state_lock);
+    RoomState* st = room_state_find(room_number);
+    if (st) {
+        found = 1;
+        snprintf(r->door, sizeof(r->door), "%s", st->door);
+        r->pw_loaded = st->pw_loaded;
+        strcpy(r->pw_hash, st->pw_hash);
+        strcpy(r->last_image, st->last_image);
+        r->last_event = st->last_event;
+        r->open_count = st->open_count;
+        r->wrong_password_count = st->wrong_password_count;
+        r->intruder_count = st->intruder_count;
+        r->last_open_ms = st->last_open_ms;
+        r->last_event_ms = st->last_event_ms;
+        strcpy(r->pw_salt, st->pw_salt);
+        strcpy(r->pw_salted, st->pw_salted);
+        r->uids_loaded = st->uids_loaded;
+        r->uid_count = st->uid_count;
+        memcpy(r->uids, st->uids, sizeof(r->uids));
+        r->cred_version = st->cred_version;
+    }
+    pthread_rwlock_unlock(&room_state_lock);
+
+    AttemptSlot* slot = attempt_slot(room_number, 0);
+    if (slot) {
+        long long left = atomic_load(&slot->locked_until_ms) - now_ms(); //  ð -> н ð
+        if (left > 0) r->locked_until_ms = epoch_ms() + left;
+        r->lockouts = atomic_load(&slot->lockouts);
+    }
+
+    RoomNode* node = room_node_hold(room_number); //   :    尡 Ǵ   
+    if (node) {
+        found = 1;
+        pthread_mutex_lock(&node->lock);
+        r->cmd_acked = node->cmd_acked;
+        r->cmd_nacked = node->cmd_nacked;
+        r->cmd_timeouts = node->cmd_timeouts;
+        r->cmd_rtt_last_ms = node->cmd_rtt_last_ms;
+        r->cmd_rtt_max_ms = node->cmd_rtt_max_ms;
+        r->cmd_rtt_avg_ms = node->cmd_rtt_avg_ms;
+        pthread_mutex_unlock(&node->lock);
+        room_node_release(node);
+    }
+    return found ? 0 : -1;
+}
+
+//  : ڵ  ĳ, ,  (  ̸ ) ä, ٸ    ǳʶ
+void persist_apply(const SnapRecord* r) {
+    if (r->room_number[0] == '\0' || !memchr(r->room_number, '\0', sizeof(r->room_number)) ||
+        owner_node(r->room_number) != self_node) {
+        return;
+    }
+    pthread_rwlock_wrlock(&room_state_lock);
+    RoomState* st = room_state_find_or_add(r->room_number);
+    st->pw_loaded = r->pw_loaded && memchr(r->pw_hash, '\0', sizeof(r->pw_hash)) != NULL;
+    if (st->pw_loaded) strcpy(st->pw_hash, r->pw_hash);
+    if (memchr(r->last_image, '\0', sizeof(r->last_image))) strcpy(st->last_image, r->last_image);
+    st->door = "unknown"; //  ٽ ϱ 
+    st->open_count = r->open_count;
+    st->wrong_password_count = r->wrong_password_count;
+    st->intruder_count = r->intruder_count;
+    st->last_open_ms = r->last_open_ms;
+    st->last_event = r->last_event >= 0 && r->last_event < BUS_KIND_COUNT ? r->last_event : -1;
+    st->last_event_ms = r->last_event_ms;
+    if (memchr(r->pw_salt, '\0', sizeof(r->pw_salt)) && memchr(r->pw_salted, '\0', sizeof(r->pw_salted))) {
+        strcpy(st->pw_salt, r->pw_salt);
+        strcpy(st->pw_salted, r->pw_salted);
+    }
+    st->uid_count = 0;
+    for (int i = 0; i < r->uid_count && i < CRED_MAX_UIDS; i++) {
+        if (memchr(r->uids[i], '\0', sizeof(r->uids[i]))) strcpy(st->uids[st->uid_count++], r->uids[i]);
+    }
+    st->uids_loaded = r->uids_loaded;
+    if (r->cred_version) st->cred_version = st->cred_log_base = r->cred_version; //   
+    pthread_rwlock_unlock(&room_state_lock);
+
+    long long left = r->locked_until_ms - epoch_ms();
+    if (left > 0 || r->lockouts > 0) {
+        AttemptSlot* slot = attempt_slot(r->room_number, 1);
+        if (slot) {
+            if (left > 0) atomic_store(&slot->locked_until_ms, now_ms() + left);
+            atomic_store(&slot->lockouts, r->lockouts);
+        }
+    }
+
+    RoomNode* node = find_room_node(r->room_number);
+    if (!node) {
+        node = create_room_node(r->room_number);
+        add_room_node(node);
+    }
+    pthread_mutex_lock(&node->lock);
+    node->cmd_acked = r->cmd_acked;
+    node->cmd_nacked = r->cmd_nacked;
+    node->cmd_timeouts = r->cmd_timeouts;
+    node->cmd_rtt_last_ms = r->cmd_rtt_last_ms;
+    node->cmd_rtt_max_ms = r->cmd_rtt_max_ms;
+    node->cmd_rtt_avg_ms = r->cmd_rtt_avg_ms;
+    pthread_mutex_unlock(&node->lock);
+}
+
+//  а   WAL ڵ带  ,  ڵ  ȯ
+int persist_recover(int port) {
+    char path[BUF_SIZE];
+    int rooms = 0;
+    int wal = 0;
+    uint64_t snap_seq = 0;
+
+    snprintf(path, sizeof(path), STATE_SNAP_FMT, port);
+    int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if (fd >= 0 && fstat(fd, &sb) == 0 && sb.st_size >= (off_t)sizeof(SnapHeader)) {
+        void* map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            const SnapHeader* header = (const SnapHeader*)map;
+            const SnapRecord* recs = (const SnapRecord*)(header + 1);
+            size_t recs_len = (size_t)header->count * sizeof(SnapRecord);
+            if (memcmp(header->magic, SNAP_MAGIC, sizeof(header->magic)) == 0 && header->record_size == sizeof(SnapRecord) &&
+                sizeof(SnapHeader) + recs_len == (size_t)sb.st_size &&
+                persist_sum(recs, recs_len, 14695981039346656037ull) == header->sum) {
+                for (uint32_t i = 0; i < header->count; i++) {
+                    persist_apply(&recs[i]);
+                }
+                rooms = header->count;
+                snap_seq = header->seq;
+            }
+            else {
+                printf("recover : snapshot %s broken, skip.\n", path);
+            }
+            munmap(map, sb.st_size);
+        }
+    }
+    if (fd >= 0) close(fd);
+    persist_seq = snap_seq;
+
+    snprintf(path, sizeof(path), STATE_WAL_FMT, port);
+    fd = open(path, O_RDWR);
+    if (fd >= 0) {
+        WalRecord w;
+        off_t good = 0;
+        while (read(fd, &w, sizeof(w)) == (ssize_t)sizeof(w)) {
+            if (w.magic != WAL_MAGIC || w.record_size != sizeof(SnapRecord) || wal_sum(&w) != w.sum) {
+                break; //  ߿   ڵ
+            }
+            good += sizeof(w);
+            if (w.seq > snap_seq) {
+                persist_apply(&w.room);
+                wal++;
+            }
+            if (w.seq > persist_seq) persist_seq = w.seq;
+        }
+        if (ftruncate(fd, good) < 0) perror("wal truncate fail"); // ߸  
+        close(fd);
+    }
+    if (rooms > 0 || wal > 0) {
+        printf("recover : %d rooms from snapshot, %d wal records.\n", rooms, wal);
+    }
+    return rooms + wal;
+}
+
+//   :  ·  (/Ѱܹ  )   , ϸ   
+int persist_start(int port) {
+    char path[BUF_SIZE];
+    if (mkdir(STATE_DIR, 0755) == -1 && errno != EEXIST) {
+        perror("state dir fail");
+        return -1;
+    }
+    persist_port = port;
+    snprintf(path, sizeof(path), STATE_WAL_FMT, port);
+    persist_wal_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (persist_wal_fd < 0) {
+        perror("wal open fail");
+        return -1;
+    }
+    persist_snapshot();
+    pthread_t tid;
+    pthread_create(&tid, NULL, persist_thread, NULL);
+    pthread_detach(tid);
+    return 0;
+}
+
+//     (ӽ  mmap ä  rename)  WAL 
+int persist_snapshot(void) {
+    int capacity = 256;
+    int count = 0;
+    char (*rooms)[10] = malloc(capacity * sizeof(*rooms));
+    pthread_rwlock_rdlock(&room_state_lock);
+    for (int b = 0; b < ROOM_STATE_BUCKETS; b++) {
+        for (RoomState* st = room_states[b]; st; st = st->next) {
+            if (count == capacity) {
+                capacity *= 2;
+                rooms = realloc(rooms, capacity * sizeof(*rooms));
+            }
+            strcpy(rooms[count++], st->room_number);
+        }
+    }
+    pthread_rwlock_unlock(&room_state_lock);
+
+    char path[BUF_SIZE];
+    char tmp_path[BUF_SIZE + 8];
+    snprintf(path, sizeof(path), STATE_SNAP_FMT, persist_port);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    size_t size = sizeof(SnapHeader) + (size_t)count * sizeof(SnapRecord);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        perror("snapshot open fail");
+        if (fd >= 0) close(fd);
+        free(rooms);
+        return -1;
+    }
+    SnapHeader* header = (SnapHeader*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        perror("snapshot mmap fail");
+        close(fd);
+        free(rooms);
+        return -1;
+    }
+    SnapRecord* recs = (SnapRecord*)(header + 1);
+    uint32_t n = 0;
+    for (int i = 0; i < count; i++) {
+        if (persist_fill(rooms[i], &recs[n]) == 0) n++;
+    }
+    free(rooms);
+    memcpy(header->magic, SNAP_MAGIC, sizeof(header->magic));
+    header->count = n;
+    header->record_size = sizeof(SnapRecord);
+    header->seq = persist_seq;
+    header->saved_ms = epoch_ms();
+    header->sum = persist_sum(recs, (size_t)n * sizeof(SnapRecord), 14695981039346656037ull);
+    int ok = msync(header, size, MS_SYNC) == 0;
+    munmap(header, size);
+    if (ok && n < (uint32_t)count) {
+        ok = ftruncate(fd, sizeof(SnapHeader) + (size_t)n * sizeof(SnapRecord)) == 0 && fsync(fd) == 0;
+    }
+    close(fd);
+    if (!ok || rename(tmp_path, path) < 0) {
+        perror("snapshot write fail");
+        return -1;
+    }
+    //    WAL (⼭ ܵ seq  ڵ   ǳʶ)
+    if (ftruncate(persist_wal_fd, 0) == 0) persist_wal_bytes = 0;
+    return 0;
+}
+
+// ٲ   ڵ带 WAL  ߰ϰ ũ ݿ
+int persist_wal_append(char (*rooms)[10], int count) {
+    WalRecord* recs = (WalRecord*)malloc((size_t)count * sizeof(WalRecord));
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        WalRecord* w = &recs[n];
+        if (persist_fill(rooms[i], &w->room) < 0) continue;
+        w->magic = WAL_MAGIC;
+        w->record_size = sizeof(SnapRecord);
+        w->seq = ++persist_seq;
+        w->sum = wal_sum(w);
+        n++;
+    }
+    size_t len = (size_t)n * sizeof(WalRecord);
+    const char* data = (const char*)recs;
+    int result = 0;
+    while (len > 0) {
+        ssize_t written = write(persist_wal_fd, data, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            perror("wal write fail");
+            result = -1;
+            break;
+        }
+        data += written;
+        len -= written;
+        persist_wal_bytes += written;
+    }
+    free(recs);
+    if (result == 0 && n > 0) fdatasync(persist_wal_fd);
+    return result;
+}
+
+//   : PERSIST_WAL_MS  ٲ  WAL,  ֱⰡ ǰų WAL Ŀ 
+void* persist_thread(void* arg) {
+    static char rooms[PERSIST_DIRTY_SLOTS][10];
+    long long last_snapshot = now_ms();
+    while (1) {
+        usleep(PERSIST_WAL_MS * 1000);
+        if (handoff_phase != 0) {
+            continue; //   :   Ѱܹ ·  
+        }
+        int count = 0;
+        pthread_mutex_lock(&persist_mutex);
+        int overflow = persist_overflow;
+        for (int i = 0; i < PERSIST_DIRTY_SLOTS && persist_dirty_count > 0; i++) {
+            if (persist_dirty[i][0] == '\0') continue;
+            strcpy(rooms[count++], persist_dirty[i]);
+            persist_dirty[i][0] = '\0';
+            persist_dirty_count--;
+        }
+        persist_dirty_count = 0;
+        persist_overflow = 0;
+        pthread_mutex_unlock(&persist_mutex);
+
+        if (overflow || persist_wal_bytes > PERSIST_WAL_MAX || now_ms() - last_snapshot >= PERSIST_SNAPSHOT_MS) {
+            persist_snapshot();
+            last_snapshot = now_ms();
+        }
+        else if (count > 0) {
+            persist_wal_append(rooms, count);
+        }
+    }
+    return NULL;
 }